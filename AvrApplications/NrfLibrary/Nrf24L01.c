@@ -1,8 +1,15 @@
 #include "include/Nrf24L01Registers.h"
 #include "include/Nrf24L01.h"
+#ifndef NRF_NO_HEAP
 #include <stdlib.h>
+#endif
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#ifdef NRF_STATIC_HW
+// hardware bound at compile time, the application provides nrf_hw.h
+#include "nrf_hw.h"
+#endif
 
 struct NrfController
 {
@@ -15,6 +22,9 @@ struct NrfController
 
 };
 
+_Static_assert(sizeof(struct NrfController) <= sizeof(NrfControllerStorage),
+    "NRF_CONTROLLER_STORAGE_SIZE too small");
+
 static const uint8_t child_pipes[] = {
     NRF_RX_ADDR_P0_REG,
     NRF_RX_ADDR_P1_REG,
@@ -44,6 +54,38 @@ const static uint8_t rx_payload_width_registers[] = {
 
 static const uint8_t maximum_allowed_pipe_num = sizeof(child_pipes)/sizeof(child_pipes[0]);
 
+#ifdef NRF_STATIC_HW
+
+static inline void
+set_csn_pin(NrfController* nrf, uint8_t value)
+{
+    (void)nrf;
+    nrf_hw_set_csn_pin(value);
+}
+
+static inline void
+set_ce_pin(NrfController* nrf, uint8_t value)
+{
+    (void)nrf;
+    nrf_hw_set_ce_pin(value);
+}
+
+static inline uint8_t
+exchange_byte(NrfController* nrf, uint8_t byte_value)
+{
+    (void)nrf;
+    return nrf_hw_exchange_byte(byte_value);
+}
+
+static inline void
+delay_us(NrfController* nrf, uint16_t delay)
+{
+    (void)nrf;
+    nrf_hw_delay_us(delay);
+}
+
+#else
+
 static inline void
 set_csn_pin(NrfController* nrf, uint8_t value)
 {
@@ -63,24 +105,35 @@ exchange_byte(NrfController* nrf, uint8_t byte_value)
 }
 
 static inline void
-delay_us(NrfController* nrf, double delay)
+delay_us(NrfController* nrf, uint16_t delay)
 {
     nrf->hw_iface->delay_us(nrf->hw_iface_udata, delay);
 }
 
+#endif
+
 NrfController*
-nrf_controller_new(NrfHardwareInterface* low_level_interface, void* user_data)
+nrf_controller_init(NrfControllerStorage* storage, NrfHardwareInterface* low_level_interface, void* user_data)
 {
-    NrfController* result = calloc(1,sizeof(NrfController));
+    NrfController* result = (NrfController*)storage;
     result->hw_iface = low_level_interface;
     result->hw_iface_udata = user_data;
     result->ack_payload_enabled = false;
     result->dynamic_payloads_enabled = false;
+    result->wide_band = false;
     result->payload_size = 32;
     return result;
-    
 }
 
+#ifndef NRF_NO_HEAP
+NrfController*
+nrf_controller_new(NrfHardwareInterface* low_level_interface, void* user_data)
+{
+    NrfControllerStorage* storage = calloc(1, sizeof(NrfControllerStorage));
+    return nrf_controller_init(storage, low_level_interface, user_data);
+}
+#endif
+
 uint8_t
 nrf_controller_read_byte_register(NrfController* nrf, uint8_t register_val)
 {
@@ -391,7 +444,8 @@ nrf_controller_write_ack_payload(NrfController* nrf, uint8_t pipe, const uint8_t
     uint8_t data_len, blank_len;
     calculate_payload_lengths(nrf, length, &data_len, &blank_len);
     set_csn_pin(nrf, 0);
-    exchange_byte(nrf, NRF_W_ACK_PAYLOAD_INST | (pipe & 0x07));
+    // status is shifted out before the payload, a full fifo ignores the write
+    uint8_t status = exchange_byte(nrf, NRF_W_ACK_PAYLOAD_INST | (pipe & 0x07));
     while (data_len--) {
         exchange_byte(nrf, *buffer);
         ++buffer;
@@ -400,7 +454,26 @@ nrf_controller_write_ack_payload(NrfController* nrf, uint8_t pipe, const uint8_t
         exchange_byte(nrf, 0);
     }
     set_csn_pin(nrf, 1);
-    return true;
+    return !(status & (1 << NRF_STATUS_BIT_TX_FULL));
+}
+
+NrfCtrlTxFifoState
+nrf_controller_get_tx_fifo_state(NrfController* nrf)
+{
+    uint8_t fifo_status = nrf_controller_read_byte_register(nrf, NRF_FIFO_STATUS_REG);
+    if (fifo_status & (1 << NRF_FIFO_STATUS_BIT_TX_EMPTY)) {
+        return NRF_CTRL_TX_FIFO_EMPTY;
+    }
+    if (fifo_status & (1 << NRF_FIFO_STATUS_BIT_FIFO_FULL)) {
+        return NRF_CTRL_TX_FIFO_FULL;
+    }
+    return NRF_CTRL_TX_FIFO_PARTIAL;
+}
+
+void
+nrf_controller_flush_tx(NrfController* nrf)
+{
+    nrf_controller_exec_byte_command(nrf, NRF_FLUSH_TX_INST);
 }
 
 uint8_t
@@ -446,10 +519,28 @@ nrf_controller_stop_listening(NrfController* nrf)
     // do we need to restore some EN_RXADDR
 }
 
+bool
+nrf_controller_resume_listening(NrfController* nrf)
+{
+    const uint8_t listening_bits = (1 << NRF_CONFIG_BIT_PWR_UP) | (1 << NRF_CONFIG_BIT_PRIM_RX);
+    uint8_t config = nrf_controller_read_byte_register(nrf, NRF_CONFIG_REG);
+    if((config & listening_bits) == listening_bits) {
+        set_ce_pin(nrf, 1);
+        return false;
+    }
+    nrf_controller_write_byte_register(nrf, NRF_CONFIG_REG, config | listening_bits);
+    // power down to standby-I with the crystal oscillator, the rest of the setup was retained
+    delay_us(nrf, 1500);
+    set_ce_pin(nrf, 1);
+    return true;
+}
+
 
+#ifndef NRF_NO_HEAP
 void
 nrf_controller_free(NrfController* controller)
 {
     free(controller);
 }
+#endif
 
@@ -0,0 +1,206 @@
+#include "include/Nrf24L01Bulk.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+void
+nrf_bulk_sender_init(NrfBulkSender* sender)
+{
+    sender->is_active = false;
+}
+
+bool
+nrf_bulk_sender_start(NrfBulkSender* sender, NrfController* nrf, uint8_t pipe, uint16_t length,
+        NrfBulkReadFn read, void* user_data)
+{
+    if(length > NRF_BULK_MAX_LENGTH) {
+        return false;
+    }
+    sender->nrf = nrf;
+    sender->read = read;
+    sender->read_udata = user_data;
+    sender->length = length;
+    sender->pipe = pipe;
+    // an empty blob still sends its last segment
+    sender->segment_count = (length == 0) ? 1 : (length + NRF_BULK_SEGMENT_DATA_MAX - 1) / NRF_BULK_SEGMENT_DATA_MAX;
+    sender->next_new = 0;
+    sender->queued_count = 0;
+    sender->has_last_sent = false;
+    sender->is_started = false;
+    sender->is_active = true;
+    return true;
+}
+
+void
+nrf_bulk_sender_cancel(NrfBulkSender* sender)
+{
+    if(sender->is_active && sender->is_started) {
+        nrf_controller_flush_tx(sender->nrf);
+    }
+    sender->is_active = false;
+}
+
+static void
+take_queued_head(NrfBulkSender* sender)
+{
+    if(sender->queued_count == 0) {
+        sender->has_last_sent = false;
+        return;
+    }
+    sender->last_sent = sender->queued[0];
+    sender->has_last_sent = true;
+    --sender->queued_count;
+    for(uint8_t i = 0; i != sender->queued_count; ++i) {
+        sender->queued[i] = sender->queued[i + 1];
+    }
+    // pulls came faster than they were handled and got empty acks
+    if(nrf_controller_get_tx_fifo_state(sender->nrf) == NRF_CTRL_TX_FIFO_EMPTY) {
+        sender->queued_count = 0;
+    }
+}
+
+static bool
+is_in_flight(const NrfBulkSender* sender, uint8_t segment)
+{
+    if(sender->has_last_sent && sender->last_sent == segment) {
+        return true;
+    }
+    for(uint8_t i = 0; i != sender->queued_count; ++i) {
+        if(sender->queued[i] == segment) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+find_next_segment(NrfBulkSender* sender, uint8_t base, uint8_t received_mask, uint8_t* segment)
+{
+    // missing segments first, they hold back the window of the receiver
+    for(uint8_t candidate = base; candidate != sender->next_new; ++candidate) {
+        if((received_mask & (1 << (candidate - base))) || is_in_flight(sender, candidate)) {
+            continue;
+        }
+        *segment = candidate;
+        return true;
+    }
+    if(sender->next_new < sender->segment_count && sender->next_new - base < NRF_BULK_WINDOW) {
+        *segment = sender->next_new++;
+        return true;
+    }
+    return false;
+}
+
+static bool
+queue_segment(NrfBulkSender* sender, uint8_t segment)
+{
+    uint8_t payload[NRF_BULK_SEGMENT_HEADER_LENGTH + NRF_BULK_SEGMENT_DATA_MAX];
+    const uint16_t offset = (uint16_t)segment * NRF_BULK_SEGMENT_DATA_MAX;
+    const uint16_t remaining = sender->length - offset;
+    const uint8_t data_length = (remaining < NRF_BULK_SEGMENT_DATA_MAX) ? remaining : NRF_BULK_SEGMENT_DATA_MAX;
+    payload[0] = NRF_BULK_SEGMENT_MARKER;
+    payload[1] = segment;
+    payload[2] = (segment + 1 == sender->segment_count) ? NRF_BULK_SEGMENT_FLAG_LAST : 0;
+    sender->read(sender->read_udata, offset, &payload[NRF_BULK_SEGMENT_HEADER_LENGTH], data_length);
+    if(!nrf_controller_write_ack_payload(sender->nrf, sender->pipe, payload, NRF_BULK_SEGMENT_HEADER_LENGTH + data_length)) {
+        return false;
+    }
+    sender->queued[sender->queued_count++] = segment;
+    return true;
+}
+
+void
+nrf_bulk_sender_handle_pull(NrfBulkSender* sender, const uint8_t* frame, uint8_t length)
+{
+    if(!sender->is_active || !nrf_bulk_is_pull(frame, length)) {
+        return;
+    }
+    const uint8_t base = frame[1];
+    const uint8_t received_mask = frame[2];
+    if(!sender->is_started) {
+        // the ack of the first pull carried whatever was queued before the transfer
+        nrf_controller_flush_tx(sender->nrf);
+        sender->is_started = true;
+    } else {
+        take_queued_head(sender);
+    }
+    if(base >= sender->segment_count) {
+        nrf_controller_flush_tx(sender->nrf);
+        sender->is_active = false;
+        return;
+    }
+    if(base > sender->next_new) {
+        // report of some other transfer
+        return;
+    }
+    uint8_t segment;
+    while(sender->queued_count != NRF_BULK_TX_FIFO_DEPTH && find_next_segment(sender, base, received_mask, &segment)) {
+        if(!queue_segment(sender, segment)) {
+            break;
+        }
+    }
+}
+
+void
+nrf_bulk_receiver_init(NrfBulkReceiver* receiver, NrfBulkDeliverFn deliver, void* user_data)
+{
+    receiver->deliver = deliver;
+    receiver->deliver_udata = user_data;
+    receiver->base = 0;
+    receiver->received_mask = 0;
+    receiver->segment_count = 0;
+}
+
+uint8_t
+nrf_bulk_receiver_make_pull(const NrfBulkReceiver* receiver, uint8_t* frame)
+{
+    frame[0] = NRF_BULK_PULL_MARKER;
+    frame[1] = receiver->base;
+    frame[2] = receiver->received_mask;
+    return NRF_BULK_PULL_LENGTH;
+}
+
+bool
+nrf_bulk_receiver_accept(NrfBulkReceiver* receiver, const uint8_t* payload, uint8_t length)
+{
+    if(length < NRF_BULK_SEGMENT_HEADER_LENGTH || payload[0] != NRF_BULK_SEGMENT_MARKER) {
+        return false;
+    }
+    const uint8_t segment = payload[1];
+    if(segment < receiver->base || segment - receiver->base >= NRF_BULK_WINDOW) {
+        return false;
+    }
+    const uint8_t bit = 1 << (segment - receiver->base);
+    if(receiver->received_mask & bit) {
+        return false;
+    }
+    if(payload[2] & NRF_BULK_SEGMENT_FLAG_LAST) {
+        receiver->segment_count = segment + 1;
+    }
+    const uint8_t data_length = length - NRF_BULK_SEGMENT_HEADER_LENGTH;
+    if(bit == 1) {
+        // in order, no need to keep it
+        receiver->deliver(receiver->deliver_udata, &payload[NRF_BULK_SEGMENT_HEADER_LENGTH], data_length);
+    } else {
+        const uint8_t slot = segment % NRF_BULK_WINDOW;
+        memcpy(receiver->segments[slot], &payload[NRF_BULK_SEGMENT_HEADER_LENGTH], data_length);
+        receiver->lengths[slot] = data_length;
+    }
+    receiver->received_mask |= bit;
+    while(receiver->received_mask & 1) {
+        receiver->received_mask >>= 1;
+        ++receiver->base;
+        const uint8_t slot = receiver->base % NRF_BULK_WINDOW;
+        if(receiver->received_mask & 1) {
+            receiver->deliver(receiver->deliver_udata, receiver->segments[slot], receiver->lengths[slot]);
+        }
+    }
+    return true;
+}
+
+bool
+nrf_bulk_receiver_is_done(const NrfBulkReceiver* receiver)
+{
+    return receiver->segment_count != 0 && receiver->base >= receiver->segment_count;
+}
@@ -5,6 +5,14 @@
 #include <stdbool.h>
 
 
+// Hardware access goes through this interface unless the library is compiled with
+// NRF_STATIC_HW, then nrf_hw.h of the application must define the inline functions
+//     uint8_t nrf_hw_exchange_byte(uint8_t send);
+//     void nrf_hw_set_ce_pin(uint8_t value);
+//     void nrf_hw_set_csn_pin(uint8_t value);
+//     void nrf_hw_delay_us(uint16_t us);
+// and the interface passed to nrf_controller_init (or nrf_controller_new without NRF_NO_HEAP)
+// is ignored (may be NULL).
 typedef struct NrfHardwareInterface
 {
 	uint8_t (*exchange_byte)(void*, uint8_t send);
@@ -16,6 +24,14 @@ typedef struct NrfHardwareInterface
 struct NrfController;
 typedef struct NrfController NrfController;
 
+// room for a controller without the heap, the layout stays private to the library
+#define NRF_CONTROLLER_STORAGE_SIZE (2 * sizeof(void*) + 4)
+
+typedef union {
+    uint8_t bytes[NRF_CONTROLLER_STORAGE_SIZE];
+    void* alignment;
+} NrfControllerStorage;
+
 typedef enum {
     NRF_CTRL_ACK_PAYLOAD_DISABLED = 0,
     NRF_CTRL_ACK_PAYLOAD_ENABLED = 1
@@ -26,10 +42,22 @@ typedef enum {
     NRF_CTRL_DYNAMIC_PAYLOAD_ENABLED = 1
 } NrfCtrlDynamicPayloadState;
 
+typedef enum {
+    NRF_CTRL_TX_FIFO_EMPTY = 0,
+    NRF_CTRL_TX_FIFO_PARTIAL = 1,
+    NRF_CTRL_TX_FIFO_FULL = 2
+} NrfCtrlTxFifoState;
+
 #define NRF_CTRL_ANY_PIPE ((uint8_t*)0)
 
+// the controller lives in storage, nothing to free
+NrfController*
+nrf_controller_init(NrfControllerStorage* storage, NrfHardwareInterface* hw_iface, void* user_data);
+
+#ifndef NRF_NO_HEAP
 NrfController*
 nrf_controller_new(NrfHardwareInterface* hw_iface, void* user_data);
+#endif
 
 uint8_t
 nrf_controller_read_byte_register(NrfController* nrf, uint8_t register_val);
@@ -52,8 +80,10 @@ nrf_controller_exec_byte_command_with_resp(NrfController* nrf, uint8_t command,
 void
 nrf_controller_begin(NrfController* nrf);
 
+#ifndef NRF_NO_HEAP
 void
 nrf_controller_free(NrfController* controller);
+#endif
 
 uint8_t
 nrf_controller_write_payload(NrfController* nrf, const uint8_t* buffer, uint8_t length);
@@ -88,9 +118,16 @@ nrf_controller_set_dynamic_payload(NrfController* nrf, NrfCtrlDynamicPayloadStat
 void
 nrf_controller_set_ack_payloads(NrfController* nrf, NrfCtrlAckPayloadState is_enabled);
 
+// false if ack payloads are disabled or the tx fifo was full and the payload got dropped
 bool
 nrf_controller_write_ack_payload(NrfController* nrf, uint8_t pipe, const uint8_t* buffer, uint8_t length);
 
+NrfCtrlTxFifoState
+nrf_controller_get_tx_fifo_state(NrfController* nrf);
+
+void
+nrf_controller_flush_tx(NrfController* nrf);
+
 uint8_t
 nrf_controller_get_dynamic_payload_size(NrfController* nrf);
 
@@ -100,5 +137,10 @@ nrf_controller_start_listening(NrfController* nrf);
 void
 nrf_controller_stop_listening(NrfController* nrf);
 
+// back to listening with the registers and fifos kept since start_listening, pending
+// status flags stay set; true if the chip had been powered down and needed the startup delay
+bool
+nrf_controller_resume_listening(NrfController* nrf);
+
 
 #endif /* NRF24L01_H_ */
\ No newline at end of file
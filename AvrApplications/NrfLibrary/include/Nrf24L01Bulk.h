@@ -0,0 +1,114 @@
+
+#ifndef NRF24L01BULK_H_
+#define NRF24L01BULK_H_
+#include <stdint.h>
+#include <stdbool.h>
+#include "Nrf24L01.h"
+
+// Windowed transfer of a blob from the receiving side (PRX) to the transmitting side (PTX)
+// inside ack payloads. The PTX sends pull frames
+//     NRF_BULK_PULL_MARKER, base, received mask
+// where base is the first segment it still misses and bit i of the mask tells that
+// segment base + i already arrived. Every pull is acked with the next queued segment
+//     NRF_BULK_SEGMENT_MARKER, sequence number, flags, data
+// The PRX keeps its 3 deep tx fifo filled with new segments and with the ones the
+// reports show missing, a pull acked with segment n reports at most segment n - 1.
+// Both markers are below any printable character so text frames are never mistaken for them.
+
+#define NRF_BULK_PULL_MARKER 0x02
+#define NRF_BULK_SEGMENT_MARKER 0x01
+#define NRF_BULK_PULL_LENGTH 3
+#define NRF_BULK_SEGMENT_HEADER_LENGTH 3
+#define NRF_BULK_SEGMENT_DATA_MAX (32 - NRF_BULK_SEGMENT_HEADER_LENGTH)
+#define NRF_BULK_SEGMENT_FLAG_LAST 1
+// segments sent ahead of base, at most 8 to fit the mask
+#define NRF_BULK_WINDOW 4
+#define NRF_BULK_TX_FIFO_DEPTH 3
+#define NRF_BULK_MAX_SEGMENTS 255
+#define NRF_BULK_MAX_LENGTH ((uint16_t)NRF_BULK_MAX_SEGMENTS * NRF_BULK_SEGMENT_DATA_MAX)
+
+// copies length bytes of the blob starting at offset
+typedef void (*NrfBulkReadFn)(void* user_data, uint16_t offset, uint8_t* buffer, uint8_t length);
+
+// receives the blob in order, segment by segment
+typedef void (*NrfBulkDeliverFn)(void* user_data, const uint8_t* data, uint8_t length);
+
+// fields are private to the library
+typedef struct {
+    NrfController* nrf;
+    NrfBulkReadFn read;
+    void* read_udata;
+    uint16_t length;
+    uint8_t pipe;
+    uint8_t segment_count;
+    uint8_t next_new;
+    // segments in the tx fifo in order, the one taken by the latest pull is not reported yet
+    uint8_t queued[NRF_BULK_TX_FIFO_DEPTH];
+    uint8_t queued_count;
+    uint8_t last_sent;
+    bool has_last_sent;
+    bool is_started;
+    bool is_active;
+} NrfBulkSender;
+
+typedef struct {
+    NrfBulkDeliverFn deliver;
+    void* deliver_udata;
+    uint8_t base;
+    uint8_t received_mask;
+    uint8_t segment_count;
+    uint8_t lengths[NRF_BULK_WINDOW];
+    uint8_t segments[NRF_BULK_WINDOW][NRF_BULK_SEGMENT_DATA_MAX];
+} NrfBulkReceiver;
+
+void
+nrf_bulk_sender_init(NrfBulkSender* sender);
+
+// nothing gets queued before the first pull, ack payloads already in the fifo go out first
+// and the rest of them is flushed then; false if the blob is longer than NRF_BULK_MAX_LENGTH
+bool
+nrf_bulk_sender_start(NrfBulkSender* sender, NrfController* nrf, uint8_t pipe, uint16_t length,
+        NrfBulkReadFn read, void* user_data);
+
+// flushes the segments still queued, ack payloads belong to the caller again
+void
+nrf_bulk_sender_cancel(NrfBulkSender* sender);
+
+static inline bool
+nrf_bulk_sender_is_active(const NrfBulkSender* sender)
+{
+    return sender->is_active;
+}
+
+static inline bool
+nrf_bulk_is_pull(const uint8_t* frame, uint8_t length)
+{
+    return length >= NRF_BULK_PULL_LENGTH && frame[0] == NRF_BULK_PULL_MARKER;
+}
+
+static inline bool
+nrf_bulk_is_segment(const uint8_t* frame, uint8_t length)
+{
+    return length >= NRF_BULK_SEGMENT_HEADER_LENGTH && frame[0] == NRF_BULK_SEGMENT_MARKER;
+}
+
+// the transfer ends once a pull reports every segment
+void
+nrf_bulk_sender_handle_pull(NrfBulkSender* sender, const uint8_t* frame, uint8_t length);
+
+void
+nrf_bulk_receiver_init(NrfBulkReceiver* receiver, NrfBulkDeliverFn deliver, void* user_data);
+
+// returns NRF_BULK_PULL_LENGTH
+uint8_t
+nrf_bulk_receiver_make_pull(const NrfBulkReceiver* receiver, uint8_t* frame);
+
+// takes the ack payload of a pull, true if it carried a segment not seen before
+bool
+nrf_bulk_receiver_accept(NrfBulkReceiver* receiver, const uint8_t* payload, uint8_t length);
+
+// every segment delivered, one more pull lets the sender finish
+bool
+nrf_bulk_receiver_is_done(const NrfBulkReceiver* receiver);
+
+#endif /* NRF24L01BULK_H_ */
@@ -0,0 +1,241 @@
+#include "adc.h"
+#include "interrupts.h"
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
+
+typedef struct {
+    uint8_t channels[ADC_SCAN_MAX_CHANNELS];
+    uint8_t count;
+    uint8_t current;
+    uint8_t extra_bits;
+    uint16_t rounds_left;
+    uint32_t accumulators[ADC_SCAN_MAX_CHANNELS];
+    uint16_t values[ADC_SCAN_MAX_CHANNELS];
+    bool has_values;
+    bool is_running;
+} AdcScan;
+
+static volatile AdcScan adc_scan;
+static uint8_t adc_reference = ADC_REFERENCE_AVCC;
+
+#define ADC_PRESCALER 128
+// 13 adc clocks per conversion
+#define ADC_CONVERSION_CYCLES (13UL * ADC_PRESCALER)
+
+#define ADC_GAIN_STAGE_DDR DDRD
+#define ADC_GAIN_STAGE_PORT PORTD
+#define ADC_GAIN_STAGE_BIT 5
+
+static inline uint8_t
+adc_reference_bits(void)
+{
+    if(adc_reference == ADC_REFERENCE_INTERNAL_1V1) {
+        return (1 << REFS1) | (1 << REFS0);
+    }
+    return (1 << REFS0);
+}
+
+void
+adc_set_channel(uint8_t channel)
+{
+    const uint8_t channel_enable = (channel & 0x0F);
+    ADMUX = adc_reference_bits() | channel_enable;
+}
+
+void
+adc_set_reference(uint8_t reference)
+{
+    if(reference == adc_reference) {
+        return;
+    }
+    adc_reference = reference;
+    ADMUX = adc_reference_bits() | (ADMUX & 0x0F);
+    if(!(ADCSRA & (1 << ADEN))) {
+        return;
+    }
+    for(uint8_t i = 0; i != ADC_REFERENCE_SETTLE_CONVERSIONS; ++i) {
+        adc_read_value();
+    }
+}
+
+uint8_t
+adc_get_reference(void)
+{
+    return adc_reference;
+}
+
+void
+adc_set_gain_stage(bool is_enabled)
+{
+    ADC_GAIN_STAGE_DDR |= (1 << ADC_GAIN_STAGE_BIT);
+    if(is_enabled) {
+        ADC_GAIN_STAGE_PORT |= (1 << ADC_GAIN_STAGE_BIT);
+        return;
+    }
+    ADC_GAIN_STAGE_PORT &= ~(1 << ADC_GAIN_STAGE_BIT);
+}
+
+void
+adc_enable(uint8_t channel)
+{
+    PRR0 &= ~(1 << PRADC);
+    adc_set_channel(channel);
+    // ADC_PRESCALER
+    const uint8_t adc_prescaler_128 = (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
+    ADCSRA = (1 << ADEN) | adc_prescaler_128;
+}
+
+void
+adc_disable(void)
+{
+    adc_scan_stop();
+    ADCSRA &= ~(1 << ADEN);
+}
+
+static inline uint16_t
+adc_read_result(void)
+{
+    uint16_t result = 0;
+    result |= ADCL;
+    result |= (ADCH << 8);
+    return result;
+}
+
+uint16_t
+adc_read_value(void)
+{
+    ADCSRA |= (1 << ADSC);
+    while(ADCSRA & (1 << ADSC));
+    return adc_read_result();
+}
+
+// entering ADC noise reduction mode starts the conversion, ADC_vect wakes cpu up;
+// timer 1 is stopped while sleeping, adc_read_decimated_value adds the slept time to the clock
+static uint16_t
+adc_read_value_in_sleep(void)
+{
+    ADCSRA |= (1 << ADIE);
+    set_sleep_mode(SLEEP_MODE_ADC);
+    sleep_enable();
+    do {
+        sleep_cpu();
+    } while(ADCSRA & (1 << ADSC));
+    sleep_disable();
+    ADCSRA &= ~(1 << ADIE);
+    return adc_read_result();
+}
+
+uint16_t
+adc_read_decimated_value(uint8_t extra_bits, bool use_noise_reduction)
+{
+    if(extra_bits > ADC_MAX_EXTRA_BITS) {
+        extra_bits = ADC_MAX_EXTRA_BITS;
+    }
+    const uint16_t samples_count = (uint16_t)1 << (2 * extra_bits);
+    uint32_t accumulator = 0;
+    for(uint16_t i = 0; i != samples_count; i++) {
+        accumulator += use_noise_reduction ? adc_read_value_in_sleep() : adc_read_value();
+    }
+    if(use_noise_reduction) {
+        interrupts_add_stopped_cycles(samples_count * ADC_CONVERSION_CYCLES);
+    }
+    return (uint16_t)(accumulator >> extra_bits);
+}
+
+static inline uint16_t
+adc_scan_rounds(uint8_t extra_bits)
+{
+    return (uint16_t)1 << (2 * extra_bits);
+}
+
+void
+adc_scan_start(const uint8_t* channels, uint8_t count, uint8_t extra_bits)
+{
+    adc_scan_stop();
+    if(count > ADC_SCAN_MAX_CHANNELS) {
+        count = ADC_SCAN_MAX_CHANNELS;
+    }
+    if(extra_bits > ADC_MAX_EXTRA_BITS) {
+        extra_bits = ADC_MAX_EXTRA_BITS;
+    }
+    for(uint8_t i = 0; i != count; ++i) {
+        adc_scan.channels[i] = channels[i];
+        adc_scan.accumulators[i] = 0;
+    }
+    adc_scan.count = count;
+    adc_scan.current = 0;
+    adc_scan.extra_bits = extra_bits;
+    adc_scan.rounds_left = adc_scan_rounds(extra_bits);
+    adc_scan.has_values = false;
+    adc_scan_resume();
+}
+
+void
+adc_scan_stop(void)
+{
+    if(!adc_scan.is_running) {
+        return;
+    }
+    ADCSRA &= ~(1 << ADIE);
+    adc_scan.is_running = false;
+    while(ADCSRA & (1 << ADSC));
+    // the conversion finished without its interrupt
+    ADCSRA |= (1 << ADIF);
+}
+
+void
+adc_scan_resume(void)
+{
+    if(adc_scan.is_running || adc_scan.count == 0) {
+        return;
+    }
+    adc_scan.is_running = true;
+    adc_set_channel(adc_scan.channels[adc_scan.current]);
+    ADCSRA |= (1 << ADIE) | (1 << ADSC);
+}
+
+bool
+adc_scan_is_running(void)
+{
+    return adc_scan.is_running;
+}
+
+bool
+adc_scan_read(uint16_t* values)
+{
+    bool has_values;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        has_values = adc_scan.has_values;
+        for(uint8_t i = 0; i != adc_scan.count; ++i) {
+            values[i] = adc_scan.values[i];
+        }
+    }
+    return has_values;
+}
+
+// also wakes the cpu from adc noise reduction sleep, then no scan is running
+ISR(ADC_vect)
+{
+    if(!adc_scan.is_running) {
+        return;
+    }
+    uint8_t current = adc_scan.current;
+    adc_scan.accumulators[current] += adc_read_result();
+    ++current;
+    if(current == adc_scan.count) {
+        current = 0;
+        if(--adc_scan.rounds_left == 0) {
+            for(uint8_t i = 0; i != adc_scan.count; ++i) {
+                adc_scan.values[i] = (uint16_t)(adc_scan.accumulators[i] >> adc_scan.extra_bits);
+                adc_scan.accumulators[i] = 0;
+            }
+            adc_scan.has_values = true;
+            adc_scan.rounds_left = adc_scan_rounds(adc_scan.extra_bits);
+        }
+    }
+    adc_scan.current = current;
+    adc_set_channel(adc_scan.channels[current]);
+    ADCSRA |= (1 << ADSC);
+}
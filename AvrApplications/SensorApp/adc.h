@@ -0,0 +1,70 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef ADC_H_
+#define ADC_H_
+
+#define ADC_CHANNEL_INTERNAL_VBG 0xE
+#define ADC_CHANNEL_EXTERNAL_ADC3 3
+#define ADC_CHANNEL_EXTERNAL_MAX 7
+
+typedef enum {
+    ADC_REFERENCE_AVCC = 0,
+    ADC_REFERENCE_INTERNAL_1V1 = 1
+} AdcReference;
+
+// AREF capacitor settles to a new reference during these throwaway conversions
+#define ADC_REFERENCE_SETTLE_CONVERSIONS 16
+
+#define ADC_NATIVE_BITS 10
+// 4^6 samples give 16 bit result which is the most uint16_t can hold
+#define ADC_MAX_EXTRA_BITS 6
+
+#define ADC_SCAN_MAX_CHANNELS 4
+
+void
+adc_set_channel(uint8_t channel);
+
+void
+adc_enable(uint8_t channel);
+
+// kept over adc_disable, AVcc until changed
+void
+adc_set_reference(uint8_t reference);
+
+uint8_t
+adc_get_reference(void);
+
+// optional external amplifier in front of the photodiode input, switched by PD5
+void
+adc_set_gain_stage(bool is_enabled);
+
+void
+adc_disable(void);
+
+uint16_t
+adc_read_value(void);
+
+uint16_t
+adc_read_decimated_value(uint8_t extra_bits, bool use_noise_reduction);
+
+// conversions run back to back from ADC_vect cycling through the channels,
+// every channel is decimated like adc_read_decimated_value does
+void
+adc_scan_start(const uint8_t* channels, uint8_t count, uint8_t extra_bits);
+
+// waits for the running conversion, the decimation state is kept for adc_scan_resume
+void
+adc_scan_stop(void);
+
+void
+adc_scan_resume(void);
+
+bool
+adc_scan_is_running(void);
+
+// copies the latest decimated value of every channel, false until all channels have one
+bool
+adc_scan_read(uint16_t* values);
+
+#endif /* ADC_H_ */
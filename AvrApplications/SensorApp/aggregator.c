@@ -0,0 +1,81 @@
+#include "aggregator.h"
+#include <string.h>
+
+void
+aggregator_init(Aggregator* aggr, uint16_t window_size, uint8_t iir_alpha)
+{
+    aggr->window_size = window_size;
+    aggr->iir_alpha = iir_alpha;
+    aggregator_reset(aggr);
+}
+
+static inline void
+aggregator_start_window(Aggregator* aggr)
+{
+    aggr->count = 0;
+    aggr->min = UINT16_MAX;
+    aggr->max = 0;
+    aggr->sum = 0;
+    aggr->sum_of_squares = 0;
+}
+
+void
+aggregator_reset(Aggregator* aggr)
+{
+    aggregator_start_window(aggr);
+    aggr->iir_state = 0;
+    aggr->has_iir_state = false;
+    aggr->has_result = false;
+    memset(&aggr->result, 0, sizeof(aggr->result));
+}
+
+static inline void
+aggregator_update_iir(Aggregator* aggr, uint16_t sample)
+{
+    const int32_t fixed_sample = (int32_t)sample << AGGREGATOR_FRACTION_BITS;
+    if(!aggr->has_iir_state || aggr->iir_alpha == 0) {
+        aggr->iir_state = fixed_sample;
+        aggr->has_iir_state = true;
+        return;
+    }
+    // |difference| < 2^22 and alpha < 2^8 so the product fits in 31 bits
+    const int32_t difference = fixed_sample - aggr->iir_state;
+    aggr->iir_state += (difference * aggr->iir_alpha) >> 8;
+}
+
+static inline void
+aggregator_finish_window(Aggregator* aggr)
+{
+    const uint16_t count = aggr->count;
+    AggregatorResult* result = &aggr->result;
+    result->min = aggr->min;
+    result->max = aggr->max;
+    const uint64_t sum = aggr->sum;
+    result->mean = ((sum << AGGREGATOR_FRACTION_BITS) + count / 2) / count;
+    // n*sum(x^2) - sum(x)^2 avoids the per sample division of Welford's method
+    const uint64_t scaled_variance = aggr->sum_of_squares * count - sum * sum;
+    result->variance = scaled_variance / ((uint32_t)count * count);
+    aggr->has_result = true;
+    aggregator_start_window(aggr);
+}
+
+void
+aggregator_add_sample(Aggregator* aggr, uint16_t sample)
+{
+    if(!aggregator_is_enabled(aggr)) {
+        return;
+    }
+    aggregator_update_iir(aggr, sample);
+    if(sample < aggr->min) {
+        aggr->min = sample;
+    }
+    if(sample > aggr->max) {
+        aggr->max = sample;
+    }
+    aggr->sum += sample;
+    aggr->sum_of_squares += (uint32_t)sample * sample;
+    ++aggr->count;
+    if(aggr->count == aggr->window_size) {
+        aggregator_finish_window(aggr);
+    }
+}
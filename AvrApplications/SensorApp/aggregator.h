@@ -0,0 +1,47 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef AGGREGATOR_H_
+#define AGGREGATOR_H_
+
+// iir state and mean are kept in fixed point with this many fraction bits
+#define AGGREGATOR_FRACTION_BITS 6
+
+typedef struct {
+    uint16_t min;
+    uint16_t max;
+    uint32_t mean;
+    uint32_t variance;
+} AggregatorResult;
+
+typedef struct {
+    uint16_t window_size;
+    uint8_t iir_alpha;
+    uint16_t count;
+    uint16_t min;
+    uint16_t max;
+    uint32_t sum;
+    uint64_t sum_of_squares;
+    int32_t iir_state;
+    bool has_iir_state;
+    bool has_result;
+    AggregatorResult result;
+} Aggregator;
+
+// window_size == 0 disables aggregation, iir_alpha is a Q8 coefficient (alpha = iir_alpha/256)
+void
+aggregator_init(Aggregator* aggr, uint16_t window_size, uint8_t iir_alpha);
+
+void
+aggregator_reset(Aggregator* aggr);
+
+void
+aggregator_add_sample(Aggregator* aggr, uint16_t sample);
+
+static inline bool
+aggregator_is_enabled(const Aggregator* aggr)
+{
+    return aggr->window_size != 0;
+}
+
+#endif /* AGGREGATOR_H_ */
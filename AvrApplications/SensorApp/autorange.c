@@ -0,0 +1,47 @@
+#include "autorange.h"
+
+void
+autorange_init(AutoRange* autorange, uint8_t range, bool is_auto)
+{
+    autorange->is_auto = is_auto;
+    autorange->configured_range = range;
+    autorange->max_range = range;
+    autorange->range = is_auto ? AUTORANGE_RANGE_AVCC : range;
+    autorange->fitting_readings = 0;
+    autorange->down_thresholds[AUTORANGE_RANGE_AVCC] = 0;
+    autorange->down_thresholds[AUTORANGE_RANGE_1V1] = 0;
+}
+
+void
+autorange_reset(AutoRange* autorange, uint16_t vbg_on_avcc, uint8_t max_range)
+{
+    autorange->max_range = max_range;
+    autorange->range = autorange->is_auto ? AUTORANGE_RANGE_AVCC : autorange->configured_range;
+    autorange->fitting_readings = 0;
+    // switch down only when the reading lands at 3/4 of the next range, saturation is far off then
+    autorange->down_thresholds[AUTORANGE_RANGE_AVCC] = ((uint32_t)vbg_on_avcc * 3) / 4;
+    autorange->down_thresholds[AUTORANGE_RANGE_1V1] = (1023UL * 3) / (4 * AUTORANGE_GAIN_STAGE_FACTOR);
+}
+
+bool
+autorange_update(AutoRange* autorange, uint16_t native_value)
+{
+    if(!autorange->is_auto) {
+        return false;
+    }
+    if(native_value >= AUTORANGE_SATURATION && autorange->range != AUTORANGE_RANGE_AVCC) {
+        --autorange->range;
+        autorange->fitting_readings = 0;
+        return true;
+    }
+    if(autorange->range < autorange->max_range && native_value < autorange->down_thresholds[autorange->range]) {
+        if(++autorange->fitting_readings >= AUTORANGE_DOWN_READINGS) {
+            ++autorange->range;
+            autorange->fitting_readings = 0;
+            return true;
+        }
+        return false;
+    }
+    autorange->fitting_readings = 0;
+    return false;
+}
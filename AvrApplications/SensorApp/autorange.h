@@ -0,0 +1,57 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef AUTORANGE_H_
+#define AUTORANGE_H_
+
+typedef enum {
+    AUTORANGE_RANGE_AVCC = 0,
+    AUTORANGE_RANGE_1V1 = 1,
+    AUTORANGE_RANGE_1V1_GAIN = 2,
+    AUTORANGE_RANGE_COUNT = 3
+} AutoRangeRange;
+
+// native 10 bit readings at or above this are taken as saturated
+#define AUTORANGE_SATURATION 1000
+// a more sensitive range is entered after this many readings in a row fitting it
+#define AUTORANGE_DOWN_READINGS 4
+// 1.1 V against a 5 V supply, used until the internal reference gets calibrated
+#define AUTORANGE_NOMINAL_VBG_ON_AVCC 225
+// nominal amplification of the external gain stage, only used for switching decisions
+#define AUTORANGE_GAIN_STAGE_FACTOR 4
+
+typedef struct {
+    bool is_auto;
+    // fixed range, or the most sensitive range auto ranging may use
+    uint8_t configured_range;
+    uint8_t max_range;
+    uint8_t range;
+    uint8_t fitting_readings;
+    uint16_t down_thresholds[AUTORANGE_RANGE_COUNT - 1];
+} AutoRange;
+
+void
+autorange_init(AutoRange* autorange, uint8_t range, bool is_auto);
+
+// auto ranging starts in the least sensitive range, max_range may limit it to calibrated ranges
+void
+autorange_reset(AutoRange* autorange, uint16_t vbg_on_avcc, uint8_t max_range);
+
+// takes a native 10 bit reading of the current range, true if the range changed
+bool
+autorange_update(AutoRange* autorange, uint16_t native_value);
+
+static inline uint8_t
+autorange_get_range(const AutoRange* autorange)
+{
+    return autorange->range;
+}
+
+// false for the default fixed AVcc range, then samples are not tagged
+static inline bool
+autorange_is_configured(const AutoRange* autorange)
+{
+    return autorange->is_auto || autorange->configured_range != AUTORANGE_RANGE_AVCC;
+}
+
+#endif /* AUTORANGE_H_ */
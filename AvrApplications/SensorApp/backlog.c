@@ -0,0 +1,85 @@
+#include "backlog.h"
+#include "codec.h"
+#include <stddef.h>
+
+void
+backlog_init(Backlog* backlog)
+{
+    backlog->first = 0;
+    backlog->count = 0;
+    backlog->dropped = 0;
+}
+
+void
+backlog_push(Backlog* backlog, uint32_t time_ms, uint16_t value, uint8_t range)
+{
+    uint8_t index = backlog->first + backlog->count;
+    if(backlog->count == BACKLOG_CAPACITY) {
+        index = backlog->first;
+        backlog->first = (backlog->first + 1) % BACKLOG_CAPACITY;
+        if(backlog->dropped != UINT16_MAX) {
+            ++backlog->dropped;
+        }
+    } else {
+        ++backlog->count;
+    }
+    BacklogEntry* entry = &backlog->entries[index % BACKLOG_CAPACITY];
+    entry->time_ms = time_ms;
+    entry->value = value;
+    entry->range = range;
+}
+
+static void
+backlog_encode_image(const Backlog* backlog, CodecWindow* window)
+{
+    codec_put_bytes(window, backlog->dropped, 2);
+    codec_put_byte(window, backlog->count);
+    if(backlog->count == 0) {
+        return;
+    }
+    const BacklogEntry* previous = &backlog->entries[backlog->first];
+    codec_put_bytes(window, previous->time_ms, 4);
+    codec_put_bytes(window, previous->value, 2);
+    codec_put_byte(window, previous->range);
+    // samples come once a period, so the time step barely changes
+    uint32_t previous_step = 0;
+    for(uint8_t i = 1; i != backlog->count && !codec_window_is_filled(window); ++i) {
+        const BacklogEntry* entry = &backlog->entries[(backlog->first + i) % BACKLOG_CAPACITY];
+        const uint32_t step = entry->time_ms - previous->time_ms;
+        codec_put_varint(window, codec_zigzag((int32_t)(step - previous_step)));
+        const bool is_range_changed = entry->range != previous->range;
+        const int32_t value_change = (int32_t)entry->value - (int32_t)previous->value;
+        codec_put_varint(window, (codec_zigzag(value_change) << 1) | is_range_changed);
+        if(is_range_changed) {
+            codec_put_byte(window, entry->range);
+        }
+        previous_step = step;
+        previous = entry;
+    }
+}
+
+uint16_t
+backlog_get_image_size(const Backlog* backlog)
+{
+    CodecWindow window;
+    codec_window_init(&window, NULL, 0, 0);
+    backlog_encode_image(backlog, &window);
+    return window.position;
+}
+
+void
+backlog_read_image(const Backlog* backlog, uint16_t offset, uint8_t* buffer, uint8_t length)
+{
+    CodecWindow window;
+    codec_window_init(&window, buffer, offset, length);
+    backlog_encode_image(backlog, &window);
+}
+
+void
+backlog_discard(Backlog* backlog, uint8_t count)
+{
+    count = (count < backlog->count) ? count : backlog->count;
+    backlog->first = (backlog->first + count) % BACKLOG_CAPACITY;
+    backlog->count -= count;
+    backlog->dropped = 0;
+}
@@ -0,0 +1,51 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef BACKLOG_H_
+#define BACKLOG_H_
+
+// samples taken while no frame reached the sensor, kept until a drain got delivered
+#define BACKLOG_CAPACITY 40
+// drain image, little endian: dropped count (2 bytes), entry count (1 byte), then the first
+// entry as time in ms (4 bytes), raw value (2 bytes) and range (1 byte); every following entry
+// is a varint of the zig-zag change of its time step (mod 2^32), then a varint of the zig-zag
+// value change shifted left by one, bit 0 set when a range byte follows
+
+typedef struct {
+    uint32_t time_ms;
+    uint16_t value;
+    uint8_t range;
+} BacklogEntry;
+
+typedef struct {
+    BacklogEntry entries[BACKLOG_CAPACITY];
+    uint8_t first;
+    uint8_t count;
+    // oldest entries overwritten since the last drain, a gap precedes the first entry then
+    uint16_t dropped;
+} Backlog;
+
+void
+backlog_init(Backlog* backlog);
+
+// overwrites the oldest entry when full
+void
+backlog_push(Backlog* backlog, uint32_t time_ms, uint16_t value, uint8_t range);
+
+static inline uint8_t
+backlog_get_count(const Backlog* backlog)
+{
+    return backlog->count;
+}
+
+uint16_t
+backlog_get_image_size(const Backlog* backlog);
+
+void
+backlog_read_image(const Backlog* backlog, uint16_t offset, uint8_t* buffer, uint8_t length);
+
+// drops the first count entries once they got delivered, the gap mark goes with them
+void
+backlog_discard(Backlog* backlog, uint8_t count);
+
+#endif /* BACKLOG_H_ */
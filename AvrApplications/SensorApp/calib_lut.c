@@ -0,0 +1,19 @@
+#include "calib_lut.h"
+
+int32_t
+calib_lut_apply(const CalibLut* lut, uint16_t raw, uint8_t oversampling_bits)
+{
+    const uint8_t segment_bits = CALIB_LUT_SEGMENT_BITS + oversampling_bits;
+    uint8_t segment = raw >> segment_bits;
+    uint16_t position = raw & ((1U << segment_bits) - 1);
+    if(segment >= CALIB_LUT_KNOT_COUNT) {
+        // not a reading of this scale, stay at the last knot
+        segment = CALIB_LUT_KNOT_COUNT - 1;
+        position = 1U << segment_bits;
+    }
+    const int32_t scale = (int32_t)1 << lut->shift;
+    const int32_t start = (segment == 0) ? 0 : lut->knots[segment - 1] * scale;
+    const int32_t end = lut->knots[segment] * scale;
+    const int32_t correction = start + (((end - start) * position) >> segment_bits);
+    return (((int32_t)raw << CALIB_LUT_FRACTION_BITS) >> oversampling_bits) + correction;
+}
@@ -0,0 +1,38 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef CALIB_LUT_H_
+#define CALIB_LUT_H_
+
+// Piecewise linear correction of the native 10 bit scale, applied before zero and gain error.
+// Knot i holds the correction at native value (i + 1) * 2^CALIB_LUT_SEGMENT_BITS, the one at 0
+// is always 0 since the zero error covers the offset. Values between knots are interpolated
+// in integers, the correction comes out in 1/2^CALIB_LUT_FRACTION_BITS native lsb.
+
+#define CALIB_LUT_SEGMENT_BITS 6
+#define CALIB_LUT_KNOT_COUNT (1024 >> CALIB_LUT_SEGMENT_BITS)
+#define CALIB_LUT_FRACTION_BITS 6
+// 127 << 10 in 1/64 lsb goes past the whole scale
+#define CALIB_LUT_MAX_SHIFT 10
+// erased eeprom reads as a disabled table
+#define CALIB_LUT_DISABLED 0xFF
+
+// a whole table fits the eeprom queue at once
+typedef __attribute__((packed)) struct {
+    // knots are scaled by 2^shift, CALIB_LUT_DISABLED leaves the readings as they are
+    uint8_t shift;
+    int8_t knots[CALIB_LUT_KNOT_COUNT];
+} CalibLut;
+
+static inline bool
+calib_lut_is_enabled(const CalibLut* lut)
+{
+    return lut->shift <= CALIB_LUT_MAX_SHIFT;
+}
+
+// raw reading of oversampling_bits extra bits plus its correction,
+// in 1/2^CALIB_LUT_FRACTION_BITS native lsb; the table must be enabled
+int32_t
+calib_lut_apply(const CalibLut* lut, uint16_t raw, uint8_t oversampling_bits);
+
+#endif /* CALIB_LUT_H_ */
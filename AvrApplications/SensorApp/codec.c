@@ -0,0 +1,38 @@
+#include "codec.h"
+
+void
+codec_window_init(CodecWindow* window, uint8_t* buffer, uint16_t offset, uint8_t length)
+{
+    window->buffer = buffer;
+    window->offset = offset;
+    window->position = 0;
+    window->length = length;
+}
+
+void
+codec_put_byte(CodecWindow* window, uint8_t value)
+{
+    if(window->position >= window->offset && window->position - window->offset < window->length) {
+        window->buffer[window->position - window->offset] = value;
+    }
+    ++window->position;
+}
+
+void
+codec_put_bytes(CodecWindow* window, uint32_t value, uint8_t count)
+{
+    while(count--) {
+        codec_put_byte(window, (uint8_t)value);
+        value >>= 8;
+    }
+}
+
+void
+codec_put_varint(CodecWindow* window, uint32_t value)
+{
+    while(value >= 0x80) {
+        codec_put_byte(window, (uint8_t)value | 0x80);
+        value >>= 7;
+    }
+    codec_put_byte(window, (uint8_t)value);
+}
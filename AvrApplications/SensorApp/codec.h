@@ -0,0 +1,46 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef CODEC_H_
+#define CODEC_H_
+
+// Byte oriented sample coding: deltas are zig-zag mapped so small changes of either sign
+// get small codes, then written as varints of 7 bits per byte, low bits first with the top
+// bit set on all but the last byte. Encoders run from the start of the stream every time and
+// the window keeps just the requested bytes, so random access needs no buffer.
+
+typedef struct {
+    uint8_t* buffer;
+    uint16_t offset;
+    uint16_t position;
+    uint8_t length;
+} CodecWindow;
+
+// buffer receives the stream bytes [offset, offset + length)
+void
+codec_window_init(CodecWindow* window, uint8_t* buffer, uint16_t offset, uint8_t length);
+
+// true once the encoder may stop, position then holds the stream size if length was 0
+static inline bool
+codec_window_is_filled(const CodecWindow* window)
+{
+    return window->length != 0 && window->position >= window->offset + window->length;
+}
+
+static inline uint32_t
+codec_zigzag(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+void
+codec_put_byte(CodecWindow* window, uint8_t value);
+
+// little endian
+void
+codec_put_bytes(CodecWindow* window, uint32_t value, uint8_t count);
+
+void
+codec_put_varint(CodecWindow* window, uint32_t value);
+
+#endif /* CODEC_H_ */
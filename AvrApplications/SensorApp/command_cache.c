@@ -0,0 +1,51 @@
+#include "command_cache.h"
+#include <string.h>
+
+uint8_t
+command_cache_checksum(const char* command, uint8_t length)
+{
+    uint8_t checksum = 0;
+    for(uint8_t i = 0; i != length; ++i) {
+        checksum = (uint8_t)((checksum << 1) | (checksum >> 7)) ^ (uint8_t)command[i];
+    }
+    return checksum;
+}
+
+void
+command_cache_init(CommandCache* cache)
+{
+    memset(cache, 0, sizeof(CommandCache));
+}
+
+const CommandCacheEntry*
+command_cache_find(const CommandCache* cache, uint8_t id, uint8_t checksum)
+{
+    for(uint8_t i = 0; i != COMMAND_CACHE_ENTRIES; ++i) {
+        const CommandCacheEntry* entry = &cache->entries[i];
+        if(entry->id == id && entry->checksum == checksum) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+CommandCacheEntry*
+command_cache_insert(CommandCache* cache, uint8_t id, uint8_t checksum)
+{
+    CommandCacheEntry* entry = &cache->entries[cache->next];
+    cache->next = (cache->next + 1) % COMMAND_CACHE_ENTRIES;
+    entry->id = id;
+    entry->checksum = checksum;
+    entry->length = 0;
+    return entry;
+}
+
+void
+command_cache_set_response(CommandCacheEntry* entry, const char* response, uint8_t length)
+{
+    if(length > COMMAND_CACHE_RESP_MAX) {
+        length = COMMAND_CACHE_RESP_MAX;
+    }
+    memcpy(entry->response, response, length);
+    entry->length = length;
+}
@@ -0,0 +1,44 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef COMMAND_CACHE_H_
+#define COMMAND_CACHE_H_
+
+// commands may be tagged as "@<id><command>", id is a printable character chosen by the desktop
+#define COMMAND_ID_PREFIX '@'
+#define COMMAND_ID_NONE 0
+// untagged, a desktop clears the ids of earlier sessions with it when it connects
+#define COMMAND_CLEAR_IDS "cmd_clear_ids"
+#define COMMAND_CACHE_ENTRIES 4
+#define COMMAND_CACHE_RESP_MAX 32
+
+typedef struct {
+    uint8_t id;
+    // ids wrap around, replay only if the command text matches as well
+    uint8_t checksum;
+    uint8_t length;
+    char response[COMMAND_CACHE_RESP_MAX];
+} CommandCacheEntry;
+
+typedef struct {
+    CommandCacheEntry entries[COMMAND_CACHE_ENTRIES];
+    uint8_t next;
+} CommandCache;
+
+uint8_t
+command_cache_checksum(const char* command, uint8_t length);
+
+void
+command_cache_init(CommandCache* cache);
+
+const CommandCacheEntry*
+command_cache_find(const CommandCache* cache, uint8_t id, uint8_t checksum);
+
+// evicts the oldest entry, the response is empty until command_cache_set_response
+CommandCacheEntry*
+command_cache_insert(CommandCache* cache, uint8_t id, uint8_t checksum);
+
+void
+command_cache_set_response(CommandCacheEntry* entry, const char* response, uint8_t length);
+
+#endif /* COMMAND_CACHE_H_ */
@@ -0,0 +1,89 @@
+#include "eeprom_queue.h"
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <util/atomic.h>
+
+typedef struct {
+    uint16_t addr;
+    uint8_t value;
+} EepromQueueEntry;
+
+#define EEPROM_QUEUE_MASK (EEPROM_QUEUE_CAPACITY - 1)
+
+static EepromQueueEntry queue[EEPROM_QUEUE_CAPACITY];
+static volatile uint8_t queue_head = 0;
+static volatile uint8_t queue_tail = 0;
+
+static inline uint8_t
+eeprom_queue_free_entries(void)
+{
+    return EEPROM_QUEUE_MASK - ((queue_head - queue_tail) & EEPROM_QUEUE_MASK);
+}
+
+bool
+eeprom_queue_write_block(const void* src, uint16_t eeprom_addr, uint8_t length)
+{
+    const uint8_t* bytes = (const uint8_t*)src;
+    bool result = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if(eeprom_queue_free_entries() >= length) {
+            uint8_t head = queue_head;
+            while(length--) {
+                queue[head].addr = eeprom_addr++;
+                queue[head].value = *bytes++;
+                head = (head + 1) & EEPROM_QUEUE_MASK;
+            }
+            queue_head = head;
+            // EE_READY fires as soon as the previous write (if any) is over
+            EECR |= (1 << EERIE);
+            result = true;
+        }
+    }
+    return result;
+}
+
+uint8_t
+eeprom_queue_get_free_space(void)
+{
+    uint8_t result;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        result = eeprom_queue_free_entries();
+    }
+    return result;
+}
+
+bool
+eeprom_queue_is_pending(void)
+{
+    bool result = false;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        result = (queue_head != queue_tail) || (EECR & (1 << EEPE));
+    }
+    return result;
+}
+
+void
+eeprom_queue_wait_until_done(void)
+{
+    while(eeprom_queue_is_pending());
+}
+
+ISR(EE_READY_vect)
+{
+    while(queue_tail != queue_head) {
+        const uint16_t addr = queue[queue_tail].addr;
+        const uint8_t value = queue[queue_tail].value;
+        queue_tail = (queue_tail + 1) & EEPROM_QUEUE_MASK;
+        EEAR = addr;
+        EECR |= (1 << EERE);
+        if(EEDR == value) {
+            // skipping unchanged cells saves ~3.4 ms and a write cycle each
+            continue;
+        }
+        EEDR = value;
+        EECR |= (1 << EEMPE);
+        EECR |= (1 << EEPE);
+        return;
+    }
+    EECR &= ~(1 << EERIE);
+}
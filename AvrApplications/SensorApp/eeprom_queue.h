@@ -0,0 +1,23 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef EEPROM_QUEUE_H_
+#define EEPROM_QUEUE_H_
+
+// must be a power of two
+#define EEPROM_QUEUE_CAPACITY 32
+
+bool
+eeprom_queue_write_block(const void* src, uint16_t eeprom_addr, uint8_t length);
+
+// bytes a write_block can take right now
+uint8_t
+eeprom_queue_get_free_space(void);
+
+bool
+eeprom_queue_is_pending(void);
+
+void
+eeprom_queue_wait_until_done(void);
+
+#endif /* EEPROM_QUEUE_H_ */
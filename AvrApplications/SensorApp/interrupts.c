@@ -7,6 +7,10 @@
 static volatile bool int_zero_occured = false;
 static volatile bool is_timeout = false;
 static volatile uint8_t seconds_counter = 0;
+static volatile uint32_t uptime_seconds = 0;
+static uint16_t ticks_per_second = 1;
+// stopped cycles short of a whole timer tick
+static uint16_t stopped_cycles_remainder = 0;
 
 static inline bool
 read_and_clear_bool_flag(volatile bool* flag)
@@ -33,20 +37,102 @@ interrupts_read_timeout_and_clear(void)
     return read_and_clear_bool_flag(&is_timeout);    
 }
 
+uint16_t
+interrupts_get_uptime_seconds(void)
+{
+    uint16_t result;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        result = uptime_seconds;
+    }
+    return result;
+}
+
+uint32_t
+interrupts_get_time_ms(void)
+{
+    uint32_t seconds;
+    uint16_t ticks;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        seconds = uptime_seconds;
+        ticks = TCNT1;
+        // compare match happened but its interrupt did not run yet
+        if((TIFR1 & (1 << OCF1A)) && ticks < (ticks_per_second >> 1)) {
+            seconds++;
+        }
+    }
+    return seconds * 1000UL + ((uint32_t)ticks * 1000UL) / ticks_per_second;
+}
+
+static uint8_t timeout_sec= 0;
+
+static inline void
+count_second(void)
+{
+    uptime_seconds++;
+    seconds_counter++;
+    if (timeout_sec == seconds_counter) {
+        seconds_counter = 0;
+        is_timeout = true;
+    }
+}
+
+void
+interrupts_add_stopped_cycles(uint32_t cpu_cycles)
+{
+    cpu_cycles += stopped_cycles_remainder;
+    stopped_cycles_remainder = cpu_cycles % INTERRUPTS_TIMER_PRESCALER;
+    uint32_t ticks = cpu_cycles / INTERRUPTS_TIMER_PRESCALER;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks += TCNT1;
+        while(ticks >= ticks_per_second) {
+            ticks -= ticks_per_second;
+            count_second();
+        }
+        TCNT1 = ticks;
+    }
+}
+
 void
 interrupts_reset_timer(void)
 {
-    TCNT1L = 0;
-    TCNT1H = 0;
-    seconds_counter = 0;
+    // timer itself keeps counting so the clock stays monotonic, timeout is accurate to one second
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        seconds_counter = 0;
+    }
 }
 
-static uint8_t timeout_sec= 0;
+static inline void
+set_int0_sense(uint8_t sense_bits)
+{
+    // changing the sense may raise the flag, so INT0 is masked meanwhile
+    EIMSK &= ~(1 << INT0);
+    EICRA = (EICRA & ~((1 << ISC01) | (1 << ISC00))) | sense_bits;
+    EIFR = (1 << INTF0);
+    EIMSK |= (1 << INT0);
+}
+
+bool
+interrupts_prepare_sleep(void)
+{
+    // a low level also wakes the cpu when the line went down before sleeping
+    set_int0_sense(0);
+    return !int_zero_occured;
+}
+
+void
+interrupts_resume(void)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        set_int0_sense(1 << ISC01);
+        seconds_counter = 0;
+    }
+}
 
 void
 interrupts_init(uint16_t ticks_for_one_second, uint8_t timeout_seconds)
 {
     timeout_sec = timeout_seconds;
+    ticks_per_second = ticks_for_one_second;
     // configure external interrupt 0
     EICRA |= (1 << ISC01) | (0 << ISC00);
     EIMSK |= (1 << INT0);
@@ -63,14 +149,14 @@ interrupts_init(uint16_t ticks_for_one_second, uint8_t timeout_seconds)
 
 ISR(TIMER1_COMPA_vect)
 {
-    seconds_counter++;
-    if (timeout_sec == seconds_counter) {
-        seconds_counter = 0;
-        is_timeout = true;
-    }
+    count_second();
 }
 
 ISR(INT0_vect)
 {
     int_zero_occured = true;
+    // level sensing would fire again until the line goes up, interrupts_resume unmasks it
+    if(!(EICRA & (1 << ISC01))) {
+        EIMSK &= ~(1 << INT0);
+    }
 }
\ No newline at end of file
@@ -22,10 +22,31 @@ interrupts_read_timeout_and_clear(void);
 void
 interrupts_reset_timer(void);
 
+uint16_t
+interrupts_get_uptime_seconds(void);
+
+// free running clock, stopped while the cpu is powered down
+uint32_t
+interrupts_get_time_ms(void);
+
+// moves the clock and the timeout on by cpu cycles slept with timer 1 stopped
+void
+interrupts_add_stopped_cycles(uint32_t cpu_cycles);
+
 void
 interrupts_init(uint16_t ticks_for_one_second, uint8_t timeout_seconds);
 
-#define INTERRUPTS_F_CPU_TO_TIMER_TICKS(value) ((value)/1024UL)
+// edge detection of INT0 needs the I/O clock, power down can only be left on its low level;
+// call with interrupts disabled and keep them so until sleeping, false if INT0 fired already
+bool
+interrupts_prepare_sleep(void);
+
+// timer and interrupt setup survive power down, restores the INT0 sense and restarts the timeout
+void
+interrupts_resume(void);
+
+#define INTERRUPTS_TIMER_PRESCALER 1024UL
+#define INTERRUPTS_F_CPU_TO_TIMER_TICKS(value) ((value)/INTERRUPTS_TIMER_PRESCALER)
 
 #define SEI() sei()
 #define CLI() cli()
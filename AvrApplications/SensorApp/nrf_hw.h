@@ -0,0 +1,57 @@
+#ifndef F_CPU
+// keep in sync with main.c
+#define F_CPU 12000000UL
+#endif
+#include <avr/io.h>
+#include <stdint.h>
+#include <util/delay_basic.h>
+
+#ifndef NRF_HW_H_
+#define NRF_HW_H_
+
+// nrf24l01 wiring: SPI1, CE on PC2, CSN on PE2
+// inlined into NrfLibrary when it is compiled with NRF_STATIC_HW
+
+static inline uint8_t
+nrf_hw_exchange_byte(uint8_t byte_to_send)
+{
+    SPDR1 = byte_to_send;
+    while (!(SPSR1 & (1 << SPIF1)));
+    return SPDR1;
+}
+
+static inline void
+nrf_hw_set_ce_pin(uint8_t value)
+{
+    if (value) {
+        PORTC |= (1 << 2);
+        return;
+    }
+    PORTC &= ~(1 << 2);
+}
+
+static inline void
+nrf_hw_set_csn_pin(uint8_t value)
+{
+    if (value) {
+        PORTE |= (1 << 2);
+        return;
+    }
+    PORTE &= ~(1 << 2);
+}
+
+// _delay_loop_2 takes 4 cycles per iteration, 0 iterations mean 65536
+static inline void
+nrf_hw_delay_us(uint16_t us_time)
+{
+    uint32_t ticks = (uint32_t)us_time * (F_CPU / 4000000UL);
+    while (ticks > UINT16_MAX) {
+        _delay_loop_2(0);
+        ticks -= (uint32_t)UINT16_MAX + 1;
+    }
+    if (ticks != 0) {
+        _delay_loop_2((uint16_t)ticks);
+    }
+}
+
+#endif /* NRF_HW_H_ */
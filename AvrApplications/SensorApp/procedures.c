@@ -1,5 +1,10 @@
 
 #include "procedures.h"
+#include "eeprom_queue.h"
+#include "adc.h"
+#include "aggregator.h"
+#include "report_filter.h"
+#include "interrupts.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -16,86 +21,105 @@ static const char false_resp[] = "FALSE";
 static const char out_of_range_resp[] = "OUT_OF_RANGE";
 static const char no_conf_selected_resp[] = "NO_CONF_SELECTED";
 static const char meas_errors_cleared_resp[] = "MEAS_ERRORS_CLEARED";
+static const char busy_resp[] = "BUSY";
+static const char no_change_resp[] = "NO_CHANGE";
 
 static const char none_value[] = "NONE";
+static const char not_available_value[] = "NA";
 
 #define ARR_SIZE(arr) (sizeof(arr)/sizeof(arr[0]))
 #define EEPROM_DATA_ADDR ((void*)0)
+#define EEPROM_DATA_OFFSET(member) ((uint16_t)offsetof(EepromData, member))
 
-#define ADC_CHANNEL_INTERNAL_VBG 0xE
-#define ADC_CHANNEL_EXTERNAL_ADC3 3
-
-static inline void
-adc_set_channel(uint8_t channel)
-{
-    const uint8_t reference_avcc_pin = (1 << REFS0);
-    const uint8_t channel_enable = (channel & 0x0F);
-    ADMUX = reference_avcc_pin | channel_enable;
-}
-
-static inline void
-adc_enable(uint8_t channel)
-{
-    PRR0 &= ~(1 << PRADC);
-    adc_set_channel(channel);
-    const uint8_t adc_prescaler_128 = (1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0);
-    ADCSRA = (1 << ADEN) | adc_prescaler_128;
-}
-
-static inline void
-adc_disable(void)
-{
-    ADCSRA &= ~(1 << ADEN);
-}
-static inline uint16_t
-adc_read_value(void)
-{
-    ADCSRA |= (1 << ADSC);
-    while(ADCSRA & (1 << ADSC));
-    uint16_t result = 0;
-    result |= ADCL;
-    result |= (ADCH << 8);
-    return result;
-}
+// calibration values are kept in native 10 bit units
+#define CALIBRATION_EXTRA_BITS 2
 
 static inline uint16_t
-adc_read_oversampled_value(uint8_t samples_count)
+read_calibration_value(void)
 {
-    uint16_t result = 0;
-    for(uint8_t i = 0; i != samples_count; i++) {
-        result += adc_read_value();
-    }
-    result /= samples_count;
-    return result;
+    uint16_t value = adc_read_decimated_value(CALIBRATION_EXTRA_BITS, false);
+    return (value + (1 << (CALIBRATION_EXTRA_BITS - 1))) >> CALIBRATION_EXTRA_BITS;
 }
 
 inline static bool
 procedures_is_internal_voltage_high_enough(ProceduresData* data)
 {
+    const bool is_scanning = adc_scan_is_running();
+    adc_scan_stop();
+    // internal_vol_data holds the reference measured against AVcc
+    const uint8_t reference = adc_get_reference();
+    adc_set_reference(ADC_REFERENCE_AVCC);
     adc_set_channel(ADC_CHANNEL_INTERNAL_VBG);
     uint16_t adc_result = adc_read_value();
-    adc_set_channel(ADC_CHANNEL_EXTERNAL_ADC3);
+    adc_set_reference(reference);
+    if(is_scanning) {
+        adc_scan_resume();
+    } else {
+        adc_set_channel(ADC_CHANNEL_EXTERNAL_ADC3);
+    }
     return adc_result <= data->internal_vol_data.value + 4;
 }
 
 static inline void
 prepare_next_resp(ProceduresData* data, const char* msg, uint8_t len)
 {
+    if(data->is_ack_preload_active && !data->is_preloading) {
+        // queued samples would be delivered before this response
+        nrf_controller_flush_tx(data->nrf_ctrl);
+        data->is_ack_preload_active = false;
+    }
     nrf_controller_write_ack_payload(data->nrf_ctrl, 1, (const uint8_t*)msg, len);
+    if(data->current_cache_entry != NULL) {
+        command_cache_set_response(data->current_cache_entry, msg, len);
+    }
 }
 
 void
-procedures_data_init(ProceduresData* data, NrfController* nrf_ctrl, char* buffer, uint8_t buff_len)
+procedures_data_init(ProceduresData* data, NrfController* nrf_ctrl)
 {
     data->nrf_ctrl = nrf_ctrl;
+    data->current_cache_entry = NULL;
+    data->is_ack_preload_active = false;
+    data->is_preloading = false;
+    command_cache_init(&data->command_cache);
     eeprom_read_block(data->calib_data, EEPROM_DATA_ADDR + offsetof(EepromData, calib_data), sizeof(data->calib_data));
     eeprom_read_block(&data->internal_vol_data, EEPROM_DATA_ADDR + offsetof(EepromData, internal_vol_data), sizeof(data->internal_vol_data));
+    eeprom_read_block(data->report_conf, EEPROM_DATA_ADDR + offsetof(EepromData, report_conf), sizeof(data->report_conf));
+    for(uint8_t i = 0; i != CALIB_DATA_ELEMENTS_COUNT; ++i) {
+        // erased eeprom of a device updated from before report on change existed
+        if(data->report_conf[i].mode == REPORT_MODE_ERASED) {
+            memset(&data->report_conf[i], 0, sizeof(ReportConf));
+        }
+    }
+    eeprom_read_block(data->range_calib, EEPROM_DATA_ADDR + offsetof(EepromData, range_calib), sizeof(data->range_calib));
+    for(uint8_t i = 0; i != CALIB_DATA_ELEMENTS_COUNT; ++i) {
+        for(uint8_t range = 0; range != AUTORANGE_RANGE_COUNT - 1; ++range) {
+            RangeCalib* range_calib = &data->range_calib[i].ranges[range];
+            // erased eeprom of a device updated from before range calibration existed
+            if(range_calib->flags == RANGE_CALIB_ERASED_FLAGS) {
+                range_calib->flags = 0;
+            }
+        }
+    }
+    eeprom_read_block(data->calib_lut, EEPROM_DATA_ADDR + offsetof(EepromData, calib_lut), sizeof(data->calib_lut));
     prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
-    data->buffer = buffer;
-    data->buffer_length = buff_len;
     data->proc_state = PROC_STATE_DEFAULT;
     data->measure_int_vol_counter = -1;
     data->selected_conf = UINT8_MAX;
+    data->oversampling_bits = 0;
+    data->adc_noise_reduction = false;
+    data->scan_count = 0;
+    nrf_bulk_sender_init(&data->bulk_sender);
+    backlog_init(&data->backlog);
+    data->backlog_period_sec = 0;
+    data->last_frame_ms = 0;
+    data->last_backlog_ms = 0;
+    data->is_backlog_draining = false;
+    autorange_init(&data->autorange, AUTORANGE_RANGE_AVCC, false);
+    adc_set_gain_stage(false);
+    aggregator_init(&data->aggregator, 0, 0);
+    report_filter_reset(&data->report_filter, 0);
+    data->time_offset_ms = 0;
 }
 
 void
@@ -111,7 +135,7 @@ move_to_state(ProceduresData* data, ProceduresState state)
 }
 
 static void
-procedures_handle_nop(ProceduresData* data, const char* incoming_data)
+procedures_handle_nop(ProceduresData* data, CommandArgs* args)
 {
     switch(data->proc_state) {
         case PROC_STATE_AWAIT_NOP:
@@ -124,18 +148,125 @@ procedures_handle_nop(ProceduresData* data, const char* incoming_data)
     }
 }
 
-static inline uint8_t
-get_semicolon_idx(const char* data)
+static void
+procedures_handle_cmd_clear_ids(ProceduresData* data, CommandArgs* args)
+{
+    // in any state, answered like nop; a tagged copy is not cached either
+    command_cache_init(&data->command_cache);
+    data->current_cache_entry = NULL;
+    procedures_handle_nop(data, args);
+}
+
+// every argument parser consumes the ':' following its argument
+static bool
+args_finish_token(CommandArgs* args, const char* token_end)
+{
+    if(token_end != args->end) {
+        if(*token_end != ':') {
+            return false;
+        }
+        ++token_end;
+    }
+    args->cursor = token_end;
+    return true;
+}
+
+static bool
+args_next_uint32(CommandArgs* args, uint32_t* value)
+{
+    const char* cursor = args->cursor;
+    uint32_t result = 0;
+    while(cursor != args->end && *cursor >= '0' && *cursor <= '9') {
+        uint8_t digit = *cursor - '0';
+        if(result > (UINT32_MAX - digit) / 10) {
+            return false;
+        }
+        result = result * 10 + digit;
+        ++cursor;
+    }
+    if(cursor == args->cursor || !args_finish_token(args, cursor)) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+static bool
+args_next_uint(CommandArgs* args, uint16_t* value)
+{
+    uint32_t result;
+    if(!args_next_uint32(args, &result) || result > UINT16_MAX) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+static bool
+args_next_int16(CommandArgs* args, int16_t* value)
+{
+    bool is_negative = (args->cursor != args->end && *args->cursor == '-');
+    if(is_negative) {
+        ++args->cursor;
+    }
+    uint32_t magnitude;
+    if(!args_next_uint32(args, &magnitude) || magnitude > (uint32_t)INT16_MAX + is_negative) {
+        return false;
+    }
+    *value = is_negative ? -(int32_t)magnitude : (int32_t)magnitude;
+    return true;
+}
+
+static bool
+args_next_double(CommandArgs* args, double* value)
+{
+    // the rx frame is zero terminated, strtod stops at the separator at the latest
+    char* token_end = NULL;
+    double result = strtod(args->cursor, &token_end);
+    if(token_end == args->cursor || token_end > args->end || !args_finish_token(args, token_end)) {
+        return false;
+    }
+    *value = result;
+    return true;
+}
+
+static bool
+args_next_is_none(CommandArgs* args)
+{
+    const uint8_t none_length = ARR_SIZE(none_value) - 1;
+    if(args->end - args->cursor != none_length || 0 != memcmp(args->cursor, none_value, none_length)) {
+        return false;
+    }
+    args->cursor = args->end;
+    return true;
+}
+
+static bool
+args_next_uints(CommandArgs* args, uint16_t* values, uint8_t count)
+{
+    for(uint8_t i = 0; i != count; i++) {
+        if(!args_next_uint(args, &values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// formats into the tx buffer were done with count = snprintf result
+static void
+prepare_tx_resp(ProceduresData* data, int count)
 {
-    uint8_t semicolon_idx = 0;
-    while(data[semicolon_idx] != ':') {semicolon_idx++;}
-    return semicolon_idx;
+    if(count <= 0 || count >= (int)sizeof(data->tx_buffer)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    prepare_next_resp(data, data->tx_buffer, count);
 }
 
 static bool inline
-procedures_is_selected_calib_data_valid(ProceduresData* data)
+procedures_is_calib_data_valid(ProceduresData* data, uint8_t calib_index)
 {
-    CalibData* calib_data = &data->calib_data[data->selected_conf];
+    CalibData* calib_data = &data->calib_data[calib_index];
     if(!(calib_data->flags & CALIB_DATA_GAIN_ERROR_PRESENT)) {
         return false;
     }
@@ -148,6 +279,104 @@ procedures_is_selected_calib_data_valid(ProceduresData* data)
     return true;
 }
 
+static void
+select_adc_range(uint8_t range)
+{
+    adc_set_reference((range == AUTORANGE_RANGE_AVCC) ? ADC_REFERENCE_AVCC : ADC_REFERENCE_INTERNAL_1V1);
+    adc_set_gain_stage(range == AUTORANGE_RANGE_1V1_GAIN);
+}
+
+static void
+procedures_apply_range(ProceduresData* data)
+{
+    select_adc_range(autorange_get_range(&data->autorange));
+    // aggregation and change detection work in raw units of a single range
+    aggregator_reset(&data->aggregator);
+    report_filter_reset(&data->report_filter, interrupts_get_uptime_seconds());
+}
+
+static bool
+procedures_get_range_calibration(ProceduresData* data, uint8_t calib_index, uint8_t range,
+        int16_t* zero_error, double* gain_error)
+{
+    const uint8_t required_flags = CALIB_DATA_GAIN_ERROR_PRESENT | CALIB_DATA_ZERO_ERROR_PRESENT;
+    if(range == AUTORANGE_RANGE_AVCC) {
+        const CalibData* calib_data = &data->calib_data[calib_index];
+        *zero_error = calib_data->zero_error;
+        *gain_error = calib_data->gain_error;
+        return (calib_data->flags & required_flags) == required_flags;
+    }
+    const RangeCalib* range_calib = &data->range_calib[calib_index].ranges[range - 1];
+    *zero_error = range_calib->zero_error;
+    *gain_error = range_calib->gain_error;
+    return (range_calib->flags & required_flags) == required_flags;
+}
+
+static uint16_t
+read_measurement_sample(ProceduresData* data)
+{
+    uint16_t sample = adc_read_decimated_value(data->oversampling_bits, data->adc_noise_reduction);
+    // a reading that made the range change belongs to the old range, take it again
+    for(uint8_t i = 0; i != AUTORANGE_RANGE_COUNT; ++i) {
+        if(!autorange_update(&data->autorange, sample >> data->oversampling_bits)) {
+            break;
+        }
+        procedures_apply_range(data);
+        sample = adc_read_decimated_value(data->oversampling_bits, data->adc_noise_reduction);
+    }
+    return sample;
+}
+
+static inline uint32_t
+procedures_get_time_ms(ProceduresData* data)
+{
+    return interrupts_get_time_ms() + data->time_offset_ms;
+}
+
+static void
+prepare_measured_value_resp(ProceduresData* data, uint16_t adc_val, uint32_t time_ms)
+{
+    const uint8_t range = autorange_get_range(&data->autorange);
+    int16_t zero_error;
+    double coeff;
+    procedures_get_range_calibration(data, data->selected_conf, range, &zero_error, &coeff);
+    const CalibLut* lut = &data->calib_lut[data->selected_conf];
+    double value;
+    if(range == AUTORANGE_RANGE_AVCC && calib_lut_is_enabled(lut)) {
+        value = (double)calib_lut_apply(lut, adc_val, data->oversampling_bits) / (1 << CALIB_LUT_FRACTION_BITS);
+    } else {
+        value = (double)adc_val / (uint16_t)(1 << data->oversampling_bits);
+    }
+    value += zero_error;
+    double measured_value = coeff*value;
+    int count;
+    if(autorange_is_configured(&data->autorange)) {
+        count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%lf;%lu;%u", measured_value,
+            (unsigned long)time_ms, (unsigned)range);
+    } else {
+        count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%lf;%lu", measured_value, (unsigned long)time_ms);
+    }
+    prepare_tx_resp(data, count);
+}
+
+// "<time hex>;<value hex>;..." raw decimated values in scan order, doubles
+// of four channels would not fit a payload so the desktop applies the calibration
+static void
+prepare_scan_frame_resp(ProceduresData* data)
+{
+    uint16_t values[ADC_SCAN_MAX_CHANNELS];
+    if(!adc_scan_read(values)) {
+        prepare_next_resp(data, not_available_value, ARR_SIZE(not_available_value) - 1);
+        return;
+    }
+    const int buffer_size = sizeof(data->tx_buffer);
+    int count = snprintf(data->tx_buffer, buffer_size, "%lx", (unsigned long)procedures_get_time_ms(data));
+    for(uint8_t i = 0; i != data->scan_count && count > 0 && count < buffer_size; ++i) {
+        count += snprintf(data->tx_buffer + count, buffer_size - count, ";%x", (unsigned)values[i]);
+    }
+    prepare_tx_resp(data, count);
+}
+
 static void
 prepare_next_adc_value(ProceduresData* data)
 {
@@ -155,31 +384,56 @@ prepare_next_adc_value(ProceduresData* data)
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    CalibData* calib_data = &data->calib_data[data->selected_conf];
     if(data->measure_int_vol_counter != -1) {
         if(data->measure_int_vol_counter == 0 && !procedures_is_internal_voltage_high_enough(data)) {
-            prepare_next_resp(data, int_vol_failure_resp, ARR_SIZE(int_vol_failure_resp));
+            prepare_next_resp(data, int_vol_failure_resp, ARR_SIZE(int_vol_failure_resp) - 1);
             data->is_measurement_error = true;
             return;
         }
         data->measure_int_vol_counter = (data->measure_int_vol_counter == 0) ?
             10 : (data->measure_int_vol_counter - 1);
     }
-    uint16_t adc_val = adc_read_value();
-    int16_t value = calib_data->zero_error + adc_val;
-    double coeff = calib_data->gain_error;
-    double measured_value = coeff*value;
-    memset(data->buffer, 0, data->buffer_length - 1);
-    int count = snprintf(data->buffer, data->buffer_length, "%lf", measured_value);
-    if(count <= 0 || count >= data->buffer_length) {
-        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+    if(data->scan_count != 0) {
+        prepare_scan_frame_resp(data);
+        return;
+    }
+    const ReportConf* report_conf = &data->report_conf[data->selected_conf];
+    if(!report_conf_is_on_change(report_conf)) {
+        uint32_t time_ms = procedures_get_time_ms(data);
+        prepare_measured_value_resp(data, read_measurement_sample(data), time_ms);
+        return;
+    }
+    if(!data->report_filter.has_latest) {
+        uint32_t time_ms = procedures_get_time_ms(data);
+        report_filter_add_sample(&data->report_filter, report_conf, read_measurement_sample(data), time_ms);
+    }
+    uint16_t adc_val;
+    uint32_t time_ms;
+    if(!report_filter_take(&data->report_filter, report_conf, interrupts_get_uptime_seconds(), &adc_val, &time_ms)) {
+        prepare_next_resp(data, no_change_resp, ARR_SIZE(no_change_resp) - 1);
         return;
     }
-    prepare_next_resp(data, data->buffer, count);
+    prepare_measured_value_resp(data, adc_val, time_ms);
+}
+
+// aggregation and on change reporting stay single channel, scan frames are always sent
+static void
+procedures_start_scan(ProceduresData* data)
+{
+    for(uint8_t i = 0; i != data->scan_count; ++i) {
+        if(!procedures_is_calib_data_valid(data, data->scan_slots[i])) {
+            prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+            data->is_measurement_error = true;
+            return;
+        }
+    }
+    adc_enable(data->scan_channels[0]);
+    adc_scan_start(data->scan_channels, data->scan_count, data->oversampling_bits);
+    prepare_next_adc_value(data);
 }
 
 static void
-procedures_handle_meas_start(ProceduresData* data, const char* incoming_data)
+procedures_handle_meas_start(ProceduresData* data, CommandArgs* args)
 {
     data->is_measurement_error = false;
     if(data->proc_state != PROC_STATE_DEFAULT) {
@@ -188,23 +442,44 @@ procedures_handle_meas_start(ProceduresData* data, const char* incoming_data)
         return;
     }
     move_to_state(data, PROC_STATE_MEASUREMENT);
+    if(data->scan_count != 0) {
+        procedures_start_scan(data);
+        return;
+    }
     if(data->selected_conf == UINT8_MAX) {
         prepare_next_resp(data, no_conf_selected_resp, ARR_SIZE(no_conf_selected_resp) - 1);
         data->is_measurement_error = true;
         return;
     }
-    if (!procedures_is_selected_calib_data_valid(data)) {
+    if (!procedures_is_calib_data_valid(data, data->selected_conf)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        data->is_measurement_error = true;
+        return;
+    }
+    // auto ranging stays within the ranges calibrated for the selected configuration
+    uint8_t max_range = AUTORANGE_RANGE_AVCC;
+    int16_t zero_error;
+    double gain_error;
+    while(max_range != data->autorange.configured_range
+            && procedures_get_range_calibration(data, data->selected_conf, max_range + 1, &zero_error, &gain_error)) {
+        ++max_range;
+    }
+    if(!data->autorange.is_auto && max_range != data->autorange.configured_range) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         data->is_measurement_error = true;
         return;
     }
 
     adc_enable(ADC_CHANNEL_EXTERNAL_ADC3);
+    const uint16_t vbg_on_avcc = data->internal_vol_data.has_data ?
+        data->internal_vol_data.value : AUTORANGE_NOMINAL_VBG_ON_AVCC;
+    autorange_reset(&data->autorange, vbg_on_avcc, max_range);
+    procedures_apply_range(data);
     prepare_next_adc_value(data);
 }
 
 static void
-procedures_handle_meas_stop(ProceduresData* data, const char* incoming_data)
+procedures_handle_meas_stop(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_MEASUREMENT) {
         move_to_state(data, PROC_STATE_DEFAULT);
@@ -212,6 +487,7 @@ procedures_handle_meas_stop(ProceduresData* data, const char* incoming_data)
         return;
     }
     move_to_state(data, PROC_STATE_DEFAULT);
+    select_adc_range(AUTORANGE_RANGE_AVCC);
     adc_disable();
     data->measure_int_vol_counter = -1;
     if(data->is_measurement_error) {
@@ -223,18 +499,61 @@ procedures_handle_meas_stop(ProceduresData* data, const char* incoming_data)
 }
 
 static void
-procedures_handle_meas_get_val(ProceduresData* data, const char* incoming_data)
+procedures_handle_meas_get_val(ProceduresData* data, CommandArgs* args)
 {
-    (void)incoming_data;
+    (void)args;
     if(data->proc_state != PROC_STATE_MEASUREMENT) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
+    if(data->is_ack_preload_active
+            && nrf_controller_get_tx_fifo_state(data->nrf_ctrl) != NRF_CTRL_TX_FIFO_EMPTY) {
+        // the next sample is already queued, procedures_poll tops the fifo up again
+        return;
+    }
+    data->is_ack_preload_active = false;
     prepare_next_adc_value(data);
+    data->is_ack_preload_active = true;
+}
+
+static void
+procedures_handle_meas_get_aggr(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_MEASUREMENT || data->is_measurement_error) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    const Aggregator* aggr = &data->aggregator;
+    if(!aggr->has_result) {
+        prepare_next_resp(data, not_available_value, ARR_SIZE(not_available_value) - 1);
+        return;
+    }
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%u;%u;%lu;%lu",
+        (unsigned)aggr->result.min, (unsigned)aggr->result.max,
+        (unsigned long)aggr->result.mean, (unsigned long)aggr->result.variance);
+    prepare_tx_resp(data, count);
+}
+
+static void
+procedures_handle_meas_get_iir(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_MEASUREMENT || data->is_measurement_error) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    const Aggregator* aggr = &data->aggregator;
+    if(!aggr->has_iir_state) {
+        prepare_next_resp(data, not_available_value, ARR_SIZE(not_available_value) - 1);
+        return;
+    }
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%ld", (long)aggr->iir_state);
+    prepare_tx_resp(data, count);
 }
 
 static void
-procedures_handle_conf_set_gain_error(ProceduresData* data, const char* incloming_data)
+procedures_handle_meas_set_aggr(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
@@ -242,27 +561,45 @@ procedures_handle_conf_set_gain_error(ProceduresData* data, const char* inclomin
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t first_arg_idx = get_semicolon_idx(incloming_data) + 1;
-    char* second_arg = NULL;
-    uint8_t calib_index = strtol(&incloming_data[first_arg_idx], &second_arg, 10);
-    if(second_arg == NULL || second_arg[0] != ':') {
+    uint32_t window_size;
+    uint32_t iir_alpha;
+    if(!args_next_uint32(args, &window_size) || !args_next_uint32(args, &iir_alpha)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    if (calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+    if(window_size > UINT16_MAX || iir_alpha > UINT8_MAX) {
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
+    aggregator_init(&data->aggregator, window_size, iir_alpha);
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
 
-    ++second_arg;
-    if(0 == strcmp(none_value, second_arg)) {
+static void
+procedures_handle_conf_set_gain_error(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if (calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    if(args_next_is_none(args)) {
         data->calib_data[calib_index].flags &= ~CALIB_DATA_GAIN_ERROR_PRESENT;
         prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
         return;
     }
-    char* end_of_args = NULL;
-    double value = strtod(second_arg, &end_of_args);
-    if (!end_of_args) {
+    double value;
+    if (!args_next_double(args, &value)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -272,7 +609,7 @@ procedures_handle_conf_set_gain_error(ProceduresData* data, const char* inclomin
 }
 
 static void
-procedures_handle_conf_set_zero_error(ProceduresData* data, const char* incloming_data)
+procedures_handle_conf_set_zero_error(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
@@ -280,10 +617,8 @@ procedures_handle_conf_set_zero_error(ProceduresData* data, const char* inclomin
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t first_arg_idx = get_semicolon_idx(incloming_data) + 1;
-    char* second_arg = NULL;
-    uint8_t calib_index = strtol(&incloming_data[first_arg_idx], &second_arg, 10);
-    if(second_arg == NULL || second_arg[0] != ':') {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -291,15 +626,13 @@ procedures_handle_conf_set_zero_error(ProceduresData* data, const char* inclomin
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    ++second_arg;
-    if(0 == strcmp(none_value, second_arg)) {
+    if(args_next_is_none(args)) {
         data->calib_data[calib_index].flags &= ~CALIB_DATA_ZERO_ERROR_PRESENT;
         prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
         return;
     }
-    char* end_of_args = NULL;
-    long value = strtol(second_arg, &end_of_args, 10);
-    if (!end_of_args || value > INT16_MAX || value < INT16_MIN) {
+    int16_t value;
+    if (!args_next_int16(args, &value)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -309,7 +642,7 @@ procedures_handle_conf_set_zero_error(ProceduresData* data, const char* inclomin
 }
 
 static void
-procedures_handle_conf_set_wavelength(ProceduresData* data, const char* incloming_data)
+procedures_handle_conf_set_wavelength(ProceduresData* data, CommandArgs* args)
 {
     
     if(data->proc_state != PROC_STATE_DEFAULT) {
@@ -318,10 +651,8 @@ procedures_handle_conf_set_wavelength(ProceduresData* data, const char* inclomin
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t first_arg_idx = get_semicolon_idx(incloming_data) + 1;
-    char* second_arg = NULL;
-    uint8_t calib_index = strtol(&incloming_data[first_arg_idx], &second_arg, 10);
-    if(second_arg == NULL || second_arg[0] != ':') {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -329,15 +660,13 @@ procedures_handle_conf_set_wavelength(ProceduresData* data, const char* inclomin
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    ++second_arg;
-    if(0 == strcmp(none_value, second_arg)) {
+    if(args_next_is_none(args)) {
         data->calib_data[calib_index].flags &= ~CALIB_DATA_WAVELENGTH_PRESENT;
         prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
         return;
     }
-    char* end_of_args = NULL;
-    uint16_t value = strtol(second_arg, &end_of_args, 10);
-    if (!end_of_args || value > UINT16_MAX || value < 0) {
+    uint16_t value;
+    if (!args_next_uint(args, &value)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -347,7 +676,7 @@ procedures_handle_conf_set_wavelength(ProceduresData* data, const char* inclomin
 }
 
 static void
-procedures_handle_conf_get_gain_error(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_get_gain_error(ProceduresData* data, CommandArgs* args)
 {
     
     if(data->proc_state != PROC_STATE_DEFAULT) {
@@ -356,10 +685,8 @@ procedures_handle_conf_get_gain_error(ProceduresData* data, const char* incoming
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t calib_coeff_idx = get_semicolon_idx(incoming_data) + 1;
-    char* end_of_string = NULL;
-    uint8_t calib_index = strtol(&incoming_data[calib_coeff_idx], &end_of_string, 10);
-    if(!end_of_string) {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -367,22 +694,17 @@ procedures_handle_conf_get_gain_error(ProceduresData* data, const char* incoming
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    memset(data->buffer, 0, data->buffer_length - 1);
     if (!(data->calib_data[calib_index].flags & CALIB_DATA_GAIN_ERROR_PRESENT)) {
         prepare_next_resp(data, none_value, ARR_SIZE(none_value) - 1);
         return;
     }
     double value = data->calib_data[calib_index].gain_error;
-    int count = snprintf(data->buffer, data->buffer_length, "%lf", value);
-    if (count <= 0 || count >= data->buffer_length) {
-        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
-        return;
-    }
-    prepare_next_resp(data, data->buffer, count);
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%lf", value);
+    prepare_tx_resp(data, count);
 }
 
 static void
-procedures_handle_conf_get_zero_error(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_get_zero_error(ProceduresData* data, CommandArgs* args)
 {
     
     if(data->proc_state != PROC_STATE_DEFAULT) {
@@ -391,10 +713,8 @@ procedures_handle_conf_get_zero_error(ProceduresData* data, const char* incoming
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t calib_coeff_idx = get_semicolon_idx(incoming_data) + 1;
-    char* end_of_string = NULL;
-    uint8_t calib_index = strtol(&incoming_data[calib_coeff_idx], &end_of_string, 10);
-    if(!end_of_string) {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -402,22 +722,29 @@ procedures_handle_conf_get_zero_error(ProceduresData* data, const char* incoming
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    memset(data->buffer, 0, data->buffer_length - 1);
     if (!(data->calib_data[calib_index].flags & CALIB_DATA_ZERO_ERROR_PRESENT)) {
         prepare_next_resp(data, none_value, ARR_SIZE(none_value) - 1);
         return;
     }
     int16_t value = data->calib_data[calib_index].zero_error;
-    int count = snprintf(data->buffer, data->buffer_length, "%d", (int)value);
-    if (count <= 0 || count >= data->buffer_length) {
-        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
-        return;
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%d", (int)value);
+    prepare_tx_resp(data, count);
+}
+
+// the scan list may bind a calibration slot to another photodiode
+static uint8_t
+procedures_get_slot_channel(ProceduresData* data, uint8_t calib_index)
+{
+    for(uint8_t i = 0; i != data->scan_count; ++i) {
+        if(data->scan_slots[i] == calib_index) {
+            return data->scan_channels[i];
+        }
     }
-    prepare_next_resp(data, data->buffer, count);
+    return ADC_CHANNEL_EXTERNAL_ADC3;
 }
 
 static void
-procedures_handle_conf_measure_zero_error(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_measure_zero_error(ProceduresData* data, CommandArgs* args)
 {
     
     if(data->proc_state != PROC_STATE_DEFAULT) {
@@ -426,10 +753,8 @@ procedures_handle_conf_measure_zero_error(ProceduresData* data, const char* inco
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t calib_coeff_idx = get_semicolon_idx(incoming_data) + 1;
-    char* end_of_string = NULL;
-    uint8_t calib_index = strtol(&incoming_data[calib_coeff_idx], &end_of_string, 10);
-    if(!end_of_string) {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -437,22 +762,27 @@ procedures_handle_conf_measure_zero_error(ProceduresData* data, const char* inco
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    adc_enable(ADC_CHANNEL_EXTERNAL_ADC3);
-    data->calib_data[calib_index].zero_error = -adc_read_oversampled_value(4);
-    data->calib_data[calib_index].flags |= CALIB_DATA_ZERO_ERROR_PRESENT;
+    // a fixed range other than AVcc gets its own zero error
+    const uint8_t range = data->autorange.is_auto ? AUTORANGE_RANGE_AVCC : data->autorange.configured_range;
+    adc_enable(procedures_get_slot_channel(data, calib_index));
+    select_adc_range(range);
+    int16_t value = -read_calibration_value();
+    select_adc_range(AUTORANGE_RANGE_AVCC);
     adc_disable();
-    memset(data->buffer, 0, data->buffer_length - 1);
-    int16_t value = data->calib_data[calib_index].zero_error;
-    int count = snprintf(data->buffer, data->buffer_length, "%d", (int)value);
-    if (count <= 0 || count >= data->buffer_length) {
-        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
-        return;
-    }
-    prepare_next_resp(data, data->buffer, count);
+    if(range == AUTORANGE_RANGE_AVCC) {
+        data->calib_data[calib_index].zero_error = value;
+        data->calib_data[calib_index].flags |= CALIB_DATA_ZERO_ERROR_PRESENT;
+    } else {
+        RangeCalib* range_calib = &data->range_calib[calib_index].ranges[range - 1];
+        range_calib->zero_error = value;
+        range_calib->flags |= CALIB_DATA_ZERO_ERROR_PRESENT;
+    }
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%d", (int)value);
+    prepare_tx_resp(data, count);
 }
 
 static void
-procedures_handle_conf_get_wavelength(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_get_wavelength(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
@@ -460,10 +790,8 @@ procedures_handle_conf_get_wavelength(ProceduresData* data, const char* incoming
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t calib_coeff_idx = get_semicolon_idx(incoming_data) + 1;
-    char* end_of_string = NULL;
-    uint8_t calib_index = strtol(&incoming_data[calib_coeff_idx], &end_of_string, 10);
-    if(!end_of_string) {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -471,22 +799,17 @@ procedures_handle_conf_get_wavelength(ProceduresData* data, const char* incoming
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    memset(data->buffer, 0, data->buffer_length - 1);
     if (!(data->calib_data[calib_index].flags & CALIB_DATA_WAVELENGTH_PRESENT)) {
         prepare_next_resp(data, none_value, ARR_SIZE(none_value) - 1);
         return;
     }
     uint16_t value = data->calib_data[calib_index].wavelength;
-    int count = snprintf(data->buffer, data->buffer_length, "%u", (unsigned)value);
-    if (count <= 0 || count >= data->buffer_length) {
-        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
-        return;
-    }
-    prepare_next_resp(data, data->buffer, count);
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%u", (unsigned)value);
+    prepare_tx_resp(data, count);
 }
 
 static void
-procedures_handle_conf_select(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_select(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
@@ -494,10 +817,8 @@ procedures_handle_conf_select(ProceduresData* data, const char* incoming_data)
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t calib_coeff_idx = get_semicolon_idx(incoming_data) + 1;
-    char* end_of_string = NULL;
-    uint8_t calib_index = strtol(&incoming_data[calib_coeff_idx], &end_of_string, 10);
-    if(!end_of_string) {
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
@@ -506,11 +827,11 @@ procedures_handle_conf_select(ProceduresData* data, const char* incoming_data)
         return;
     }
     data->selected_conf = calib_index;
-    prepare_next_resp(data, ok_resp, ARR_SIZE(error_resp) - 1);
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
 }
 
 static void
-procedures_handle_conf_commit(ProceduresData* data, const char* incoming_data)
+procedures_handle_meas_set_oversampling(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
@@ -518,60 +839,60 @@ procedures_handle_conf_commit(ProceduresData* data, const char* incoming_data)
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    uint8_t calib_coeff_idx = get_semicolon_idx(incoming_data) + 1;
-    char* end_of_string = NULL;
-    uint8_t calib_index = strtol(&incoming_data[calib_coeff_idx], &end_of_string, 10);
-    if(!end_of_string) {
+    uint16_t extra_bits;
+    if(!args_next_uint(args, &extra_bits)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    if(calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+    if(extra_bits > ADC_MAX_EXTRA_BITS) {
         prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
         return;
     }
-    CalibData* calib_data = &data->calib_data[calib_index];
-    ptrdiff_t offset = offsetof(EepromData, calib_data) + sizeof(*calib_data) * calib_index;
-    eeprom_write_block(calib_data, EEPROM_DATA_ADDR + offset, sizeof(*calib_data));
-    prepare_next_resp(data, ok_resp, ARR_SIZE(error_resp) - 1);
+    data->oversampling_bits = extra_bits;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
 }
 
 static void
-procedures_handle_int_ref_enable(ProceduresData* data, const char* incoming_data)
+procedures_handle_meas_set_range(ProceduresData* data, CommandArgs* args)
 {
-    
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    if(!data->internal_vol_data.has_data) {
+    uint16_t values[2];
+    if(!args_next_uints(args, values, ARR_SIZE(values))) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    data->measure_int_vol_counter = 0;
+    if(values[0] >= AUTORANGE_RANGE_COUNT || values[1] > 1) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    autorange_init(&data->autorange, values[0], values[1] != 0);
     prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
 }
 
-static void
-procedures_handle_int_ref_calibrate(ProceduresData* data, const char* incoming_data)
+// "<slot>:<range>" of a range above AVcc, prepares the error response when it returns NULL
+static RangeCalib*
+procedures_parse_range_calib(ProceduresData* data, CommandArgs* args)
 {
-    
-    if(data->proc_state != PROC_STATE_DEFAULT) {
-        move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t values[2];
+    if(!args_next_uints(args, values, ARR_SIZE(values))) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
-        return;
+        return NULL;
     }
-    move_to_state(data, PROC_STATE_AWAIT_NOP);
-    adc_enable(ADC_CHANNEL_INTERNAL_VBG);
-    data->internal_vol_data.has_data = true;
-    data->internal_vol_data.value = adc_read_oversampled_value(4);
-    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
-    adc_disable();
+    if(values[0] >= CALIB_DATA_ELEMENTS_COUNT || values[1] == AUTORANGE_RANGE_AVCC
+            || values[1] >= AUTORANGE_RANGE_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return NULL;
+    }
+    return &data->range_calib[values[0]].ranges[values[1] - 1];
 }
 
 static void
-procedures_handle_int_ref_clear(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_set_range_zero(ProceduresData* data, CommandArgs* args)
 {
     if(data->proc_state != PROC_STATE_DEFAULT) {
         move_to_state(data, PROC_STATE_AWAIT_NOP);
@@ -579,57 +900,642 @@ procedures_handle_int_ref_clear(ProceduresData* data, const char* incoming_data)
         return;
     }
     move_to_state(data, PROC_STATE_AWAIT_NOP);
-    data->internal_vol_data.has_data = false;
+    RangeCalib* range_calib = procedures_parse_range_calib(data, args);
+    if(range_calib == NULL) {
+        return;
+    }
+    if(args_next_is_none(args)) {
+        range_calib->flags &= ~CALIB_DATA_ZERO_ERROR_PRESENT;
+        prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+        return;
+    }
+    int16_t value;
+    if(!args_next_int16(args, &value)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    range_calib->flags |= CALIB_DATA_ZERO_ERROR_PRESENT;
+    range_calib->zero_error = value;
     prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
 }
 
-
 static void
-procedures_handle_int_ref_commit(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_set_range_gain(ProceduresData* data, CommandArgs* args)
 {
-    (void)incoming_data;
     if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    RangeCalib* range_calib = procedures_parse_range_calib(data, args);
+    if(range_calib == NULL) {
+        return;
+    }
+    if(args_next_is_none(args)) {
+        range_calib->flags &= ~CALIB_DATA_GAIN_ERROR_PRESENT;
+        prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+        return;
+    }
+    double value;
+    if(!args_next_double(args, &value)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    eeprom_write_block(&data->internal_vol_data, EEPROM_DATA_ADDR + offsetof(EepromData, internal_vol_data), sizeof(data->internal_vol_data));
+    range_calib->flags |= CALIB_DATA_GAIN_ERROR_PRESENT;
+    range_calib->gain_error = value;
     prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
 }
 
+// "<zero error>;<gain error>", NONE unless both are set
 static void
-procedures_handle_int_ref_is_calibrated(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_get_range_calib(ProceduresData* data, CommandArgs* args)
 {
-    (void)incoming_data;
     if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    if(data->internal_vol_data.has_data) {
-        prepare_next_resp(data, true_resp, ARR_SIZE(true_resp) - 1);
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    const RangeCalib* range_calib = procedures_parse_range_calib(data, args);
+    if(range_calib == NULL) {
         return;
     }
-    prepare_next_resp(data, false_resp, ARR_SIZE(false_resp) - 1);
+    const uint8_t required_flags = CALIB_DATA_GAIN_ERROR_PRESENT | CALIB_DATA_ZERO_ERROR_PRESENT;
+    if((range_calib->flags & required_flags) != required_flags) {
+        prepare_next_resp(data, none_value, ARR_SIZE(none_value) - 1);
+        return;
+    }
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%d;%lf",
+        (int)range_calib->zero_error, range_calib->gain_error);
+    prepare_tx_resp(data, count);
 }
 
+// separate from conf_commit, both together would not fit the eeprom queue
 static void
-procedures_handle_int_ref_disable(ProceduresData* data, const char* incoming_data)
+procedures_handle_conf_commit_range(ProceduresData* data, CommandArgs* args)
 {
-    (void)incoming_data;
     if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    if(!data->internal_vol_data.has_data) {
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
         prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
         return;
     }
-    data->measure_int_vol_counter = -1;
+    if(calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    RangeCalibData* range_calib = &data->range_calib[calib_index];
+    uint16_t offset = EEPROM_DATA_OFFSET(range_calib) + sizeof(*range_calib) * calib_index;
+    if(!eeprom_queue_write_block(range_calib, offset, sizeof(*range_calib))) {
+        prepare_next_resp(data, busy_resp, ARR_SIZE(busy_resp) - 1);
+        return;
+    }
     prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
 }
 
+// "<slot>", prepares the error response when it returns NULL
+static CalibLut*
+procedures_parse_lut(ProceduresData* data, CommandArgs* args)
+{
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return NULL;
+    }
+    if(calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return NULL;
+    }
+    return &data->calib_lut[calib_index];
+}
 
-typedef void (*HandlerFunc)(ProceduresData*, const char*);
-struct HandlerDescription
+// "<slot>:<knot>", prepares the error response when it returns false
+static bool
+procedures_parse_lut_knot(ProceduresData* data, CommandArgs* args, CalibLut** lut, uint8_t* knot)
+{
+    *lut = procedures_parse_lut(data, args);
+    if(*lut == NULL) {
+        return false;
+    }
+    uint16_t value;
+    if(!args_next_uint(args, &value)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return false;
+    }
+    if(value >= CALIB_LUT_KNOT_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return false;
+    }
+    *knot = value;
+    return true;
+}
+
+// "<slot>:<knot>:<value>", knots take effect once conf_set_lut_shift enables the table
+static void
+procedures_handle_conf_set_lut(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    CalibLut* lut;
+    uint8_t knot;
+    if(!procedures_parse_lut_knot(data, args, &lut, &knot)) {
+        return;
+    }
+    int16_t value;
+    if(!args_next_int16(args, &value)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(value < INT8_MIN || value > INT8_MAX) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    lut->knots[knot] = value;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+// "<slot>:<shift>", NONE disables the table
+static void
+procedures_handle_conf_set_lut_shift(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    CalibLut* lut = procedures_parse_lut(data, args);
+    if(lut == NULL) {
+        return;
+    }
+    if(args_next_is_none(args)) {
+        lut->shift = CALIB_LUT_DISABLED;
+        prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+        return;
+    }
+    uint16_t shift;
+    if(!args_next_uint(args, &shift)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(shift > CALIB_LUT_MAX_SHIFT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    lut->shift = shift;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+// "<shift>;<knot value>", shift is NONE while the table is disabled so staged knots can be checked
+static void
+procedures_handle_conf_get_lut(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    CalibLut* lut;
+    uint8_t knot;
+    if(!procedures_parse_lut_knot(data, args, &lut, &knot)) {
+        return;
+    }
+    int count;
+    if(calib_lut_is_enabled(lut)) {
+        count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%u;%d",
+            (unsigned)lut->shift, (int)lut->knots[knot]);
+    } else {
+        count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%s;%d", none_value, (int)lut->knots[knot]);
+    }
+    prepare_tx_resp(data, count);
+}
+
+static void
+procedures_handle_conf_commit_lut(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    CalibLut* lut = procedures_parse_lut(data, args);
+    if(lut == NULL) {
+        return;
+    }
+    uint16_t offset = EEPROM_DATA_OFFSET(calib_lut) + sizeof(*lut) * (lut - data->calib_lut);
+    if(!eeprom_queue_write_block(lut, offset, sizeof(*lut))) {
+        prepare_next_resp(data, busy_resp, ARR_SIZE(busy_resp) - 1);
+        return;
+    }
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+read_eeprom_data_for_bulk(void* user_data, uint16_t offset, uint8_t* buffer, uint8_t length)
+{
+    (void)user_data;
+    eeprom_read_block(buffer, EEPROM_DATA_ADDR + offset, length);
+}
+
+// OK, then the whole EepromData image goes out as a bulk transfer pulled by the gateway
+static void
+procedures_handle_conf_dump(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    // the transfer takes the place of the nop
+    move_to_state(data, PROC_STATE_DEFAULT);
+    // the eeprom_queue interrupt would change the address under eeprom_read_block
+    eeprom_queue_wait_until_done();
+    nrf_bulk_sender_start(&data->bulk_sender, data->nrf_ctrl, 1, sizeof(EepromData),
+        &read_eeprom_data_for_bulk, NULL);
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_meas_set_backlog(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t period_sec;
+    if(!args_next_uint(args, &period_sec)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    // kept samples would not match the new settings
+    backlog_init(&data->backlog);
+    data->backlog_period_sec = period_sec;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+read_backlog_for_bulk(void* user_data, uint16_t offset, uint8_t* buffer, uint8_t length)
+{
+    backlog_read_image((const Backlog*)user_data, offset, buffer, length);
+}
+
+// OK, then the backlog image goes out as a bulk transfer, a running measurement goes on
+static void
+procedures_handle_meas_drain(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state == PROC_STATE_AWAIT_NOP) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+    data->backlog_drain_count = backlog_get_count(&data->backlog);
+    data->is_backlog_draining = true;
+    nrf_bulk_sender_start(&data->bulk_sender, data->nrf_ctrl, 1, backlog_get_image_size(&data->backlog),
+        &read_backlog_for_bulk, &data->backlog);
+}
+
+// pairs of adc channel and calibration slot, no pairs go back to the single channel mode
+static void
+procedures_handle_meas_set_scan(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint8_t channels[ADC_SCAN_MAX_CHANNELS];
+    uint8_t slots[ADC_SCAN_MAX_CHANNELS];
+    uint8_t count = 0;
+    while(args->cursor != args->end) {
+        uint16_t pair[2];
+        if(!args_next_uints(args, pair, ARR_SIZE(pair))) {
+            prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+            return;
+        }
+        if(count == ADC_SCAN_MAX_CHANNELS || pair[0] > ADC_CHANNEL_EXTERNAL_MAX
+                || pair[1] >= CALIB_DATA_ELEMENTS_COUNT) {
+            prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+            return;
+        }
+        channels[count] = pair[0];
+        slots[count] = pair[1];
+        ++count;
+    }
+    memcpy(data->scan_channels, channels, count);
+    memcpy(data->scan_slots, slots, count);
+    data->scan_count = count;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_meas_set_adc_sleep(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t value;
+    if(!args_next_uint(args, &value)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    data->adc_noise_reduction = (value != 0);
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_conf_set_report_mode(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t values[2];
+    if(!args_next_uints(args, values, ARR_SIZE(values))) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(values[0] >= CALIB_DATA_ELEMENTS_COUNT || values[1] > REPORT_MODE_ON_CHANGE) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    data->report_conf[values[0]].mode = values[1];
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_conf_set_band(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t values[4];
+    if(!args_next_uints(args, values, ARR_SIZE(values))) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    // a reference left at least a band behind would report a constant input on every sample
+    if(values[0] >= CALIB_DATA_ELEMENTS_COUNT || values[2] > UINT8_MAX
+            || (values[3] != 0 && values[3] >= values[1])) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    ReportConf* report_conf = &data->report_conf[values[0]];
+    report_conf->deadband_abs = values[1];
+    report_conf->deadband_rel = values[2];
+    report_conf->hysteresis = values[3];
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_conf_set_heartbeat(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t values[2];
+    if(!args_next_uints(args, values, ARR_SIZE(values))) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(values[0] >= CALIB_DATA_ELEMENTS_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    data->report_conf[values[0]].heartbeat_sec = values[1];
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_conf_get_report(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    const ReportConf* report_conf = &data->report_conf[calib_index];
+    uint8_t mode = report_conf_is_on_change(report_conf) ? REPORT_MODE_ON_CHANGE : REPORT_MODE_ALWAYS;
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%u;%u;%u;%u;%u", (unsigned)mode,
+        (unsigned)report_conf->deadband_abs, (unsigned)report_conf->deadband_rel,
+        (unsigned)report_conf->hysteresis, (unsigned)report_conf->heartbeat_sec);
+    prepare_tx_resp(data, count);
+}
+
+static void
+procedures_handle_time_sync(ProceduresData* data, CommandArgs* args)
+{
+    uint32_t local_time_ms = interrupts_get_time_ms();
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint32_t host_time_ms;
+    if(!args_next_uint32(args, &host_time_ms)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    data->time_offset_ms = host_time_ms - local_time_ms;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_time_get(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    int count = snprintf(data->tx_buffer, sizeof(data->tx_buffer), "%lu", (unsigned long)procedures_get_time_ms(data));
+    prepare_tx_resp(data, count);
+}
+
+static void
+procedures_handle_conf_commit(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    uint16_t calib_index;
+    if(!args_next_uint(args, &calib_index)) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(calib_index >= CALIB_DATA_ELEMENTS_COUNT) {
+        prepare_next_resp(data, out_of_range_resp, ARR_SIZE(out_of_range_resp) - 1);
+        return;
+    }
+    CalibData* calib_data = &data->calib_data[calib_index];
+    ReportConf* report_conf = &data->report_conf[calib_index];
+    // both blocks or none, the queue only gets emptier until they are in
+    if(eeprom_queue_get_free_space() < sizeof(*calib_data) + sizeof(*report_conf)) {
+        prepare_next_resp(data, busy_resp, ARR_SIZE(busy_resp) - 1);
+        return;
+    }
+    uint16_t offset = EEPROM_DATA_OFFSET(calib_data) + sizeof(*calib_data) * calib_index;
+    eeprom_queue_write_block(calib_data, offset, sizeof(*calib_data));
+    offset = EEPROM_DATA_OFFSET(report_conf) + sizeof(*report_conf) * calib_index;
+    eeprom_queue_write_block(report_conf, offset, sizeof(*report_conf));
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_int_ref_enable(ProceduresData* data, CommandArgs* args)
+{
+    
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    if(!data->internal_vol_data.has_data) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    data->measure_int_vol_counter = 0;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_int_ref_calibrate(ProceduresData* data, CommandArgs* args)
+{
+    
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    adc_enable(ADC_CHANNEL_INTERNAL_VBG);
+    data->internal_vol_data.has_data = true;
+    data->internal_vol_data.value = read_calibration_value();
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+    adc_disable();
+}
+
+static void
+procedures_handle_int_ref_clear(ProceduresData* data, CommandArgs* args)
+{
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        move_to_state(data, PROC_STATE_AWAIT_NOP);
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    move_to_state(data, PROC_STATE_AWAIT_NOP);
+    data->internal_vol_data.has_data = false;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+
+static void
+procedures_handle_int_ref_commit(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    uint16_t offset = EEPROM_DATA_OFFSET(internal_vol_data);
+    if(!eeprom_queue_write_block(&data->internal_vol_data, offset, sizeof(data->internal_vol_data))) {
+        prepare_next_resp(data, busy_resp, ARR_SIZE(busy_resp) - 1);
+        return;
+    }
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+static void
+procedures_handle_commit_is_pending(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(eeprom_queue_is_pending()) {
+        prepare_next_resp(data, true_resp, ARR_SIZE(true_resp) - 1);
+        return;
+    }
+    prepare_next_resp(data, false_resp, ARR_SIZE(false_resp) - 1);
+}
+
+static void
+procedures_handle_int_ref_is_calibrated(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(data->internal_vol_data.has_data) {
+        prepare_next_resp(data, true_resp, ARR_SIZE(true_resp) - 1);
+        return;
+    }
+    prepare_next_resp(data, false_resp, ARR_SIZE(false_resp) - 1);
+}
+
+static void
+procedures_handle_int_ref_disable(ProceduresData* data, CommandArgs* args)
+{
+    (void)args;
+    if(data->proc_state != PROC_STATE_DEFAULT) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    if(!data->internal_vol_data.has_data) {
+        prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
+        return;
+    }
+    data->measure_int_vol_counter = -1;
+    prepare_next_resp(data, ok_resp, ARR_SIZE(ok_resp) - 1);
+}
+
+
+typedef void (*HandlerFunc)(ProceduresData*, CommandArgs*);
+struct HandlerDescription
 {
     char* command;
     uint8_t cmd_length;
@@ -640,9 +1546,13 @@ struct HandlerDescription
 
 const static struct HandlerDescription handler_descriptions[] = {
     MAKE_HANDLER_DESCR("nop", &procedures_handle_nop),
+    MAKE_HANDLER_DESCR(COMMAND_CLEAR_IDS, &procedures_handle_cmd_clear_ids),
     MAKE_HANDLER_DESCR("meas_start", &procedures_handle_meas_start),
     MAKE_HANDLER_DESCR("meas_stop", &procedures_handle_meas_stop),
     MAKE_HANDLER_DESCR("meas_get_val", &procedures_handle_meas_get_val),
+    MAKE_HANDLER_DESCR("meas_get_aggr", &procedures_handle_meas_get_aggr),
+    MAKE_HANDLER_DESCR("meas_get_iir", &procedures_handle_meas_get_iir),
+    MAKE_HANDLER_DESCR("meas_set_aggr:", &procedures_handle_meas_set_aggr),
     MAKE_HANDLER_DESCR("conf_set_gain_error:", &procedures_handle_conf_set_gain_error),
     MAKE_HANDLER_DESCR("conf_get_gain_error:", &procedures_handle_conf_get_gain_error),
     MAKE_HANDLER_DESCR("conf_set_zero_error:", &procedures_handle_conf_set_zero_error),
@@ -650,28 +1560,147 @@ const static struct HandlerDescription handler_descriptions[] = {
     MAKE_HANDLER_DESCR("conf_measure_zero_error:", &procedures_handle_conf_measure_zero_error),
     MAKE_HANDLER_DESCR("conf_set_wavelength:", &procedures_handle_conf_set_wavelength),
     MAKE_HANDLER_DESCR("conf_get_wavelength:", &procedures_handle_conf_get_wavelength),
+    MAKE_HANDLER_DESCR("conf_set_report_mode:", &procedures_handle_conf_set_report_mode),
+    MAKE_HANDLER_DESCR("conf_set_band:", &procedures_handle_conf_set_band),
+    MAKE_HANDLER_DESCR("conf_set_heartbeat:", &procedures_handle_conf_set_heartbeat),
+    MAKE_HANDLER_DESCR("conf_get_report:", &procedures_handle_conf_get_report),
     MAKE_HANDLER_DESCR("conf_commit:", &procedures_handle_conf_commit),
     MAKE_HANDLER_DESCR("conf_select:", &procedures_handle_conf_select),
+    MAKE_HANDLER_DESCR("meas_set_oversampling:", &procedures_handle_meas_set_oversampling),
+    MAKE_HANDLER_DESCR("meas_set_adc_sleep:", &procedures_handle_meas_set_adc_sleep),
+    MAKE_HANDLER_DESCR("meas_set_scan:", &procedures_handle_meas_set_scan),
+    MAKE_HANDLER_DESCR("meas_set_range:", &procedures_handle_meas_set_range),
+    MAKE_HANDLER_DESCR("conf_set_range_zero:", &procedures_handle_conf_set_range_zero),
+    MAKE_HANDLER_DESCR("conf_set_range_gain:", &procedures_handle_conf_set_range_gain),
+    MAKE_HANDLER_DESCR("conf_get_range_calib:", &procedures_handle_conf_get_range_calib),
+    MAKE_HANDLER_DESCR("conf_commit_range:", &procedures_handle_conf_commit_range),
+    MAKE_HANDLER_DESCR("conf_set_lut:", &procedures_handle_conf_set_lut),
+    MAKE_HANDLER_DESCR("conf_set_lut_shift:", &procedures_handle_conf_set_lut_shift),
+    MAKE_HANDLER_DESCR("conf_get_lut:", &procedures_handle_conf_get_lut),
+    MAKE_HANDLER_DESCR("conf_commit_lut:", &procedures_handle_conf_commit_lut),
+    MAKE_HANDLER_DESCR("conf_dump", &procedures_handle_conf_dump),
+    MAKE_HANDLER_DESCR("meas_set_backlog:", &procedures_handle_meas_set_backlog),
+    MAKE_HANDLER_DESCR("meas_drain", &procedures_handle_meas_drain),
     MAKE_HANDLER_DESCR("int_ref_enable", &procedures_handle_int_ref_enable),
     MAKE_HANDLER_DESCR("int_ref_disable", &procedures_handle_int_ref_disable),
     MAKE_HANDLER_DESCR("int_ref_commit", &procedures_handle_int_ref_commit),
     MAKE_HANDLER_DESCR("int_ref_calibrate", &procedures_handle_int_ref_calibrate),
     MAKE_HANDLER_DESCR("int_ref_clear", &procedures_handle_int_ref_clear),
-    MAKE_HANDLER_DESCR("int_ref_is_calibrated", &procedures_handle_int_ref_is_calibrated)
+    MAKE_HANDLER_DESCR("int_ref_is_calibrated", &procedures_handle_int_ref_is_calibrated),
+    MAKE_HANDLER_DESCR("commit_is_pending", &procedures_handle_commit_is_pending),
+    MAKE_HANDLER_DESCR("time_sync:", &procedures_handle_time_sync),
+    MAKE_HANDLER_DESCR("time_get", &procedures_handle_time_get)
 };
 
-void procedures_handle_incoming_message(ProceduresData* data, const char* incoming_message)
+static void
+procedures_dispatch(ProceduresData* data, const char* message, uint8_t length)
 {
     uint8_t handler_idx = 0;
     while(handler_idx != ARR_SIZE(handler_descriptions)) {
         const struct HandlerDescription* handler_descr = &handler_descriptions[handler_idx];
-        if(0 == strncmp(handler_descr->command, incoming_message, handler_descr->cmd_length)) {
-            handler_descr->handler(data, incoming_message);
-            memset(data->buffer, 0, data->buffer_length - 1);
+        if(handler_descr->cmd_length <= length
+                && 0 == memcmp(handler_descr->command, message, handler_descr->cmd_length)) {
+            CommandArgs args = {
+                .cursor = message + handler_descr->cmd_length,
+                .end = message + length
+            };
+            handler_descr->handler(data, &args);
             return;
         }
         ++handler_idx;
     }
     prepare_next_resp(data, error_resp, ARR_SIZE(error_resp) - 1);
-    memset(data->buffer, 0, data->buffer_length - 1);
 }
+
+void procedures_handle_incoming_message(ProceduresData* data, const char* message, uint8_t length)
+{
+    data->last_frame_ms = interrupts_get_time_ms();
+    if(nrf_bulk_is_pull((const uint8_t*)message, length)) {
+        nrf_bulk_sender_handle_pull(&data->bulk_sender, (const uint8_t*)message, length);
+        if(data->is_backlog_draining && !nrf_bulk_sender_is_active(&data->bulk_sender)) {
+            // the gateway reported every segment
+            backlog_discard(&data->backlog, data->backlog_drain_count);
+            data->is_backlog_draining = false;
+        }
+        return;
+    }
+    // responses need the ack payloads back, a cancelled drain keeps its entries
+    nrf_bulk_sender_cancel(&data->bulk_sender);
+    data->is_backlog_draining = false;
+    if(length < 2 || message[0] != COMMAND_ID_PREFIX || message[1] == COMMAND_ID_NONE) {
+        procedures_dispatch(data, message, length);
+        return;
+    }
+    const uint8_t command_id = message[1];
+    const char* command = &message[2];
+    const uint8_t command_length = length - 2;
+    const uint8_t checksum = command_cache_checksum(command, command_length);
+    const CommandCacheEntry* cached = command_cache_find(&data->command_cache, command_id, checksum);
+    if(cached != NULL) {
+        // retransmission of a handled command, its ack got lost on the way to the gateway
+        if(cached->length != 0) {
+            prepare_next_resp(data, cached->response, cached->length);
+        }
+        return;
+    }
+    data->current_cache_entry = command_cache_insert(&data->command_cache, command_id, checksum);
+    procedures_dispatch(data, command, command_length);
+    data->current_cache_entry = NULL;
+}
+
+// queues one more streamed sample while the ack fifo has room
+static void
+procedures_preload_ack(ProceduresData* data)
+{
+    if(!data->is_ack_preload_active || nrf_bulk_sender_is_active(&data->bulk_sender)
+            || nrf_controller_get_tx_fifo_state(data->nrf_ctrl) == NRF_CTRL_TX_FIFO_FULL) {
+        return;
+    }
+    data->is_preloading = true;
+    prepare_next_adc_value(data);
+    data->is_preloading = false;
+}
+
+// the gateway polls at least once a period while the link is up, scan mode is not kept
+static bool
+procedures_is_backlog_due(ProceduresData* data)
+{
+    if(data->backlog_period_sec == 0 || nrf_bulk_sender_is_active(&data->bulk_sender)) {
+        return false;
+    }
+    const uint32_t now_ms = interrupts_get_time_ms();
+    const uint32_t period_ms = (uint32_t)data->backlog_period_sec * 1000UL;
+    return now_ms - data->last_frame_ms >= period_ms && now_ms - data->last_backlog_ms >= period_ms;
+}
+
+void procedures_poll(ProceduresData* data)
+{
+    if(data->proc_state != PROC_STATE_MEASUREMENT || data->is_measurement_error) {
+        return;
+    }
+    procedures_preload_ack(data);
+    if(data->scan_count != 0) {
+        return;
+    }
+    const ReportConf* report_conf = &data->report_conf[data->selected_conf];
+    const bool is_report_on_change = report_conf_is_on_change(report_conf);
+    const bool is_backlog_due = procedures_is_backlog_due(data);
+    if(!aggregator_is_enabled(&data->aggregator) && !is_report_on_change && !is_backlog_due) {
+        return;
+    }
+    uint32_t time_ms = procedures_get_time_ms(data);
+    uint16_t sample = read_measurement_sample(data);
+    aggregator_add_sample(&data->aggregator, sample);
+    if(is_report_on_change) {
+        report_filter_add_sample(&data->report_filter, report_conf, sample, time_ms);
+    }
+    if(is_backlog_due) {
+        backlog_push(&data->backlog, time_ms, sample, autorange_get_range(&data->autorange));
+        data->last_backlog_ms = interrupts_get_time_ms();
+    }
+}
+
+bool procedures_is_sleep_allowed(const ProceduresData* data)
+{
+    return data->proc_state != PROC_STATE_MEASUREMENT || data->backlog_period_sec == 0;
+}
\ No newline at end of file
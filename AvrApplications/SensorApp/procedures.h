@@ -1,5 +1,13 @@
 #include <Nrf24L01.h>
 #include <Nrf24L01Registers.h>
+#include <Nrf24L01Bulk.h>
+#include "aggregator.h"
+#include "report_filter.h"
+#include "command_cache.h"
+#include "adc.h"
+#include "autorange.h"
+#include "backlog.h"
+#include "calib_lut.h"
 #ifndef PROCEDURES_H_
 #define PROCEDURES_H_
 
@@ -17,6 +25,9 @@ enum {
     CALIB_DATA_ZERO_ERROR_PRESENT = 4
 };
 
+// largest nrf24l01 payload
+#define FRAME_MAX_LENGTH 32
+
 #define PACKED_ATTRIBUTE __attribute__((packed))
 
 typedef PACKED_ATTRIBUTE struct {
@@ -26,6 +37,20 @@ typedef PACKED_ATTRIBUTE struct {
     int16_t zero_error;
 }CalibData;
 
+// flags of erased eeprom, taken as not calibrated
+#define RANGE_CALIB_ERASED_FLAGS 0xFF
+
+// calibration of the ranges above AVcc, which uses CalibData itself
+typedef PACKED_ATTRIBUTE struct {
+    uint8_t flags;
+    int16_t zero_error;
+    double gain_error;
+}RangeCalib;
+
+typedef PACKED_ATTRIBUTE struct {
+    RangeCalib ranges[AUTORANGE_RANGE_COUNT - 1];
+}RangeCalibData;
+
 typedef PACKED_ATTRIBUTE struct {
     bool has_data;
     uint16_t value;
@@ -34,27 +59,75 @@ typedef PACKED_ATTRIBUTE struct {
 typedef PACKED_ATTRIBUTE struct {
     InternalVolData internal_vol_data;
     CalibData calib_data[CALIB_DATA_ELEMENTS_COUNT];
+    // appended so older eeprom contents keep their layout, erased areas read as defaults
+    ReportConf report_conf[CALIB_DATA_ELEMENTS_COUNT];
+    RangeCalibData range_calib[CALIB_DATA_ELEMENTS_COUNT];
+    CalibLut calib_lut[CALIB_DATA_ELEMENTS_COUNT];
 }EepromData;
 
 typedef struct {
     NrfController* nrf_ctrl;
-    char* buffer;
     CalibData calib_data[CALIB_DATA_ELEMENTS_COUNT];
     InternalVolData internal_vol_data;
     bool is_measurement_error;
     int8_t measure_int_vol_counter;
     uint8_t selected_conf;
-    uint8_t buffer_length;
+    uint8_t oversampling_bits;
+    bool adc_noise_reduction;
+    // scan mode when scan_count != 0, scan_slots[i] holds the calibration of scan_channels[i]
+    uint8_t scan_channels[ADC_SCAN_MAX_CHANNELS];
+    uint8_t scan_slots[ADC_SCAN_MAX_CHANNELS];
+    uint8_t scan_count;
+    Aggregator aggregator;
+    ReportConf report_conf[CALIB_DATA_ELEMENTS_COUNT];
+    ReportFilter report_filter;
+    RangeCalibData range_calib[CALIB_DATA_ELEMENTS_COUNT];
+    // linearizes the AVcc range of each configuration
+    CalibLut calib_lut[CALIB_DATA_ELEMENTS_COUNT];
+    AutoRange autorange;
+    // added to the local clock to get the gateway host time
+    uint32_t time_offset_ms;
+    CommandCache command_cache;
+    // entry of the tagged command being handled, records the prepared response
+    CommandCacheEntry* current_cache_entry;
+    // set while the ack fifo may hold samples queued ahead of meas_get_val polls,
+    // any other response flushes them first
+    bool is_ack_preload_active;
+    bool is_preloading;
+    // owns the ack payloads while active, any command cancels it
+    NrfBulkSender bulk_sender;
+    // while measuring a sample is kept every backlog_period_sec in which no frame arrived, 0 disables
+    Backlog backlog;
+    uint16_t backlog_period_sec;
+    uint32_t last_frame_ms;
+    uint32_t last_backlog_ms;
+    // entries carried by the running bulk transfer, discarded once the gateway has them all
+    uint8_t backlog_drain_count;
+    bool is_backlog_draining;
     uint8_t proc_state;
-    
+    // responses are formatted here, never aliases the received frame
+    char tx_buffer[FRAME_MAX_LENGTH + 1];
 }ProceduresData;
 
+// arguments of a command, parsed in place inside the received frame
+typedef struct {
+    const char* cursor;
+    const char* end;
+}CommandArgs;
+
 void
-procedures_data_init(ProceduresData* data, NrfController* nrf_ctrl, char* buffer, uint8_t buff_len);
+procedures_data_init(ProceduresData* data, NrfController* nrf_ctrl);
 
 void
 procedures_data_destroy(ProceduresData* data);
 
-void procedures_handle_incoming_message(ProceduresData* data, const char* incoming_message);
+// message holds length bytes followed by a zero terminator
+void procedures_handle_incoming_message(ProceduresData* data, const char* message, uint8_t length);
+
+// background work done between messages (continuous sampling for aggregation)
+void procedures_poll(ProceduresData* data);
+
+// false while the backlog has to go on sampling, the timer stops in power down
+bool procedures_is_sleep_allowed(const ProceduresData* data);
 
 #endif /* PROCEDURES_H_ */
\ No newline at end of file
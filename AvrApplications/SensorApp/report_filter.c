@@ -0,0 +1,79 @@
+#include "report_filter.h"
+
+void
+report_filter_reset(ReportFilter* filter, uint16_t now_sec)
+{
+    filter->reference = 0;
+    filter->latest = 0;
+    filter->pending_value = 0;
+    filter->last_report_sec = now_sec;
+    filter->latest_time_ms = 0;
+    filter->pending_time_ms = 0;
+    filter->has_latest = false;
+    filter->has_pending = false;
+}
+
+static inline uint16_t
+report_filter_band(const ReportFilter* filter, const ReportConf* conf)
+{
+    uint16_t relative_band = ((uint32_t)filter->reference * conf->deadband_rel) >> 8;
+    return (relative_band > conf->deadband_abs) ? relative_band : conf->deadband_abs;
+}
+
+static inline void
+report_filter_move_reference(ReportFilter* filter, const ReportConf* conf, uint16_t sample)
+{
+    const uint16_t hysteresis = conf->hysteresis;
+    if(sample > filter->reference) {
+        filter->reference = (sample > hysteresis) ? sample - hysteresis : 0;
+        return;
+    }
+    filter->reference = (UINT16_MAX - sample > hysteresis) ? sample + hysteresis : UINT16_MAX;
+}
+
+void
+report_filter_add_sample(ReportFilter* filter, const ReportConf* conf, uint16_t sample, uint32_t time_ms)
+{
+    if(!filter->has_latest) {
+        // first sample is always reported
+        filter->has_latest = true;
+        filter->latest = sample;
+        filter->latest_time_ms = time_ms;
+        filter->reference = sample;
+        filter->pending_value = sample;
+        filter->pending_time_ms = time_ms;
+        filter->has_pending = true;
+        return;
+    }
+    filter->latest = sample;
+    filter->latest_time_ms = time_ms;
+    const uint16_t deviation = (sample > filter->reference) ?
+        sample - filter->reference : filter->reference - sample;
+    if(deviation <= report_filter_band(filter, conf)) {
+        return;
+    }
+    report_filter_move_reference(filter, conf, sample);
+    filter->pending_value = sample;
+    filter->pending_time_ms = time_ms;
+    filter->has_pending = true;
+}
+
+bool
+report_filter_take(ReportFilter* filter, const ReportConf* conf, uint16_t now_sec, uint16_t* value, uint32_t* time_ms)
+{
+    if(filter->has_pending) {
+        filter->has_pending = false;
+        filter->last_report_sec = now_sec;
+        *value = filter->pending_value;
+        *time_ms = filter->pending_time_ms;
+        return true;
+    }
+    const uint16_t since_last_report = now_sec - filter->last_report_sec;
+    if(conf->heartbeat_sec != 0 && filter->has_latest && since_last_report >= conf->heartbeat_sec) {
+        filter->last_report_sec = now_sec;
+        *value = filter->latest;
+        *time_ms = filter->latest_time_ms;
+        return true;
+    }
+    return false;
+}
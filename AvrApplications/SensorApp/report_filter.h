@@ -0,0 +1,53 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef REPORT_FILTER_H_
+#define REPORT_FILTER_H_
+
+typedef enum {
+    REPORT_MODE_ALWAYS = 0,
+    REPORT_MODE_ON_CHANGE = 1
+} ReportMode;
+
+// mode of erased eeprom, the conf is reset to always reporting with nothing set
+#define REPORT_MODE_ERASED 0xFF
+
+// deadband_rel is a Q8 fraction of the reference, band = max(deadband_abs, relative band)
+// reference is left hysteresis counts behind the reported sample, so reversals need a bigger step;
+// hysteresis has to stay below deadband_abs, or a constant input would be reported again and again
+// all values are in raw adc units of the selected oversampling
+typedef __attribute__((packed)) struct {
+    uint8_t mode;
+    uint16_t deadband_abs;
+    uint8_t deadband_rel;
+    uint16_t hysteresis;
+    uint16_t heartbeat_sec;
+} ReportConf;
+
+typedef struct {
+    uint16_t reference;
+    uint16_t latest;
+    uint16_t pending_value;
+    uint16_t last_report_sec;
+    uint32_t latest_time_ms;
+    uint32_t pending_time_ms;
+    bool has_latest;
+    bool has_pending;
+} ReportFilter;
+
+static inline bool
+report_conf_is_on_change(const ReportConf* conf)
+{
+    return conf->mode == REPORT_MODE_ON_CHANGE;
+}
+
+void
+report_filter_reset(ReportFilter* filter, uint16_t now_sec);
+
+void
+report_filter_add_sample(ReportFilter* filter, const ReportConf* conf, uint16_t sample, uint32_t time_ms);
+
+bool
+report_filter_take(ReportFilter* filter, const ReportConf* conf, uint16_t now_sec, uint16_t* value, uint32_t* time_ms);
+
+#endif /* REPORT_FILTER_H_ */
@@ -1,6 +1,8 @@
 #define F_CPU 16000000UL
 #include <Nrf24L01.h>
 #include <Nrf24L01Registers.h>
+#include <Nrf24L01Bulk.h>
+#include "nrf_hw.h"
 #include <avr/io.h>
 #include <stdbool.h>
 #include <util/delay.h>
@@ -17,53 +19,50 @@ enable_spi_for_nrf(void)
     SPCR = (1 << MSTR) | (1 << SPE);
 }
 
+#ifndef NRF_STATIC_HW
+
 static void
 delay_us_dfn_for_nrf(void* data, double us_time)
 {
     (void)data;
-    double us_time_double = us_time;
-    double delay_1_val = ((F_CPU) / 3e6) * us_time_double;
-    double delay_2_val = ((F_CPU) / 4e6) * us_time_double;
-    // check if we can use precise timer
-    if(delay_1_val > 255) {
-        _delay_loop_2((uint16_t)delay_2_val);
-        return;
-    }
-    uint8_t delay_1_ticks = (delay_1_val < 1.0)? 1 : delay_1_val;
-    _delay_loop_1(delay_1_ticks);
+    nrf_hw_delay_us((uint16_t)us_time);
 }
 
 static uint8_t
 exchange_byte_dfn_for_nrf(void* data, uint8_t byte_to_send)
 {
     (void)data;
-    SPDR = byte_to_send;
-    while (!(SPSR & (1 << SPIF)));
-    return SPDR;
+    return nrf_hw_exchange_byte(byte_to_send);
 }
 
 static void
 set_ce_pin_dfn_for_nrf(void* data, uint8_t value)
 {
     (void)data;
-    if(value) {
-        PORTD |= (1 << 7);
-        return;
-    }
-    PORTD &= ~(1 << 7);
+    nrf_hw_set_ce_pin(value);
 }
 
 static void
 set_csn_pin_dfn_for_nrf(void* data, uint8_t value)
 {
     (void)data;
-    if (value) {
-        PORTB |= (1 << 2);
-        return;
-    }
-    PORTB &= ~(1 << 2);
+    nrf_hw_set_csn_pin(value);
 }
 
+static NrfHardwareInterface nrf_hw_iface = {
+    .set_ce_pin = &set_ce_pin_dfn_for_nrf,
+    .set_csn_pin = &set_csn_pin_dfn_for_nrf,
+    .delay_us = &delay_us_dfn_for_nrf,
+    .exchange_byte = &exchange_byte_dfn_for_nrf,
+};
+#define NRF_HW_INTERFACE (&nrf_hw_iface)
+
+#else
+
+#define NRF_HW_INTERFACE NULL
+
+#endif
+
 static void
 uart_init(unsigned int ubrr)
 {
@@ -121,16 +120,139 @@ uart_receive_command(uint8_t* command, uint8_t buffer_length)
     return index;
 }
 
-static NrfHardwareInterface nrf_hw_iface = {
-    .set_ce_pin = &set_ce_pin_dfn_for_nrf,
-    .set_csn_pin = &set_csn_pin_dfn_for_nrf,
-    .delay_us = &delay_us_dfn_for_nrf,
-    .exchange_byte = &exchange_byte_dfn_for_nrf,
-};
+// worst case of a failed write: 15 retransmissions with 3000 us auto retransmit delay
+#define WRITE_ATTEMPT_MAX_US 45000UL
+#define WRITE_DEADLINE_US 600000UL
+#define WRITE_BACKOFF_MIN_US 250U
+#define WRITE_BACKOFF_MAX_US 8000U
+// after that many failed commands in a row each command is a single probe
+#define LINK_FAILURE_THRESHOLD 3
+
+static const char no_ack_resp[] = "NO_ACK";
+static const char no_link_resp[] = "NO_LINK";
+
+static uint16_t jitter_state = 0xACE1u;
+static uint8_t consecutive_link_failures = 0;
+
+static uint16_t
+next_jitter(void)
+{
+    // 16 bit xorshift, only has to decorrelate retries from the sensor's own timing
+    jitter_state ^= jitter_state << 7;
+    jitter_state ^= jitter_state >> 9;
+    jitter_state ^= jitter_state << 8;
+    return jitter_state;
+}
+
+static void
+backoff_delay(uint16_t delay_us)
+{
+    // runtime delay to the microsecond, short delays of the first retries keep their jitter
+    nrf_hw_delay_us(delay_us);
+}
+
+static inline bool
+is_link_down(void)
+{
+    return consecutive_link_failures >= LINK_FAILURE_THRESHOLD;
+}
+
+static bool
+write_with_backoff(NrfController* nrf_ctrl, const uint8_t* data, uint8_t length)
+{
+    uint32_t elapsed_us = 0;
+    uint16_t backoff_cap_us = WRITE_BACKOFF_MIN_US;
+    while(true) {
+        nrf_controller_start_write(nrf_ctrl, data, length);
+        if(nrf_controller_finish_write_sync(nrf_ctrl)) {
+            consecutive_link_failures = 0;
+            return true;
+        }
+        elapsed_us += WRITE_ATTEMPT_MAX_US;
+        // full jitter: uniform delay in [0, cap)
+        uint16_t delay_us = next_jitter() % backoff_cap_us;
+        if(is_link_down() || elapsed_us + delay_us + WRITE_ATTEMPT_MAX_US > WRITE_DEADLINE_US) {
+            break;
+        }
+        backoff_delay(delay_us);
+        elapsed_us += delay_us;
+        if(backoff_cap_us < WRITE_BACKOFF_MAX_US) {
+            backoff_cap_us *= 2;
+        }
+    }
+    if(!is_link_down()) {
+        ++consecutive_link_failures;
+    }
+    return false;
+}
+
+// pulls in a row without a new segment before the transfer is given up
+#define BULK_MAX_IDLE_PULLS 8
+
+static const char bulk_command[] = "#bulk";
+static const char bulk_end_resp[] = "END";
+static const char error_resp[] = "ERROR";
+
+static void
+uart_send_hex_line(void* user_data, const uint8_t* data, uint8_t length)
+{
+    (void)user_data;
+    static const char hex_digits[] = "0123456789abcdef";
+    if(length == 0) {
+        // an empty line would look like a uart timeout to the host
+        return;
+    }
+    while(length) {
+        uart_send_byte(hex_digits[*data >> 4]);
+        uart_send_byte(hex_digits[*data & 0x0F]);
+        ++data;
+        --length;
+    }
+    uart_send_str("\r\n");
+}
+
+// handled by the gateway itself, streams the blob the sensor offers as hex lines ended by END
+static void
+run_bulk_transfer(NrfController* nrf_ctrl)
+{
+    NrfBulkReceiver receiver;
+    nrf_bulk_receiver_init(&receiver, &uart_send_hex_line, NULL);
+    uint8_t pull[NRF_BULK_PULL_LENGTH];
+    uint8_t payload[32];
+    uint8_t idle_pulls = 0;
+    while(true) {
+        const bool is_done = nrf_bulk_receiver_is_done(&receiver);
+        uint8_t pull_length = nrf_bulk_receiver_make_pull(&receiver, pull);
+        bool has_write_succeed = write_with_backoff(nrf_ctrl, pull, pull_length);
+        uint8_t payload_size = 0;
+        if(has_write_succeed && nrf_controller_is_message_available(nrf_ctrl, NRF_CTRL_ANY_PIPE)) {
+            payload_size = nrf_controller_get_dynamic_payload_size(nrf_ctrl);
+            nrf_controller_read_incoming(nrf_ctrl, payload, payload_size);
+        }
+        if(is_done) {
+            // this last pull only released the sender, its ack does not matter
+            uart_send_str(bulk_end_resp);
+            break;
+        }
+        if(!has_write_succeed && is_link_down()) {
+            uart_send_str(no_link_resp);
+            break;
+        }
+        bool has_progress = nrf_bulk_receiver_accept(&receiver, payload, payload_size);
+        idle_pulls = has_progress ? 0 : idle_pulls + 1;
+        if(idle_pulls == BULK_MAX_IDLE_PULLS) {
+            uart_send_str(error_resp);
+            break;
+        }
+    }
+    uart_send_str("\r\n");
+}
 
 static const uint8_t address_to_write[] = "65432";
 static const uint8_t address_to_read[] = "54321";
 static const uint8_t address_length = 5;
+
+static NrfControllerStorage nrf_ctrl_storage;
 static char buffer[33] = {};
 
 
@@ -141,7 +263,7 @@ int main(void)
 {
     enable_spi_for_nrf();
     uart_init(UART_BAUDRATE_TO_UBRR(9600UL));
-    NrfController* nrf_ctrl = nrf_controller_new(&nrf_hw_iface, NULL);
+    NrfController* nrf_ctrl = nrf_controller_init(&nrf_ctrl_storage, NRF_HW_INTERFACE, NULL);
     nrf_controller_begin(nrf_ctrl);
     nrf_controller_set_ack_payloads(nrf_ctrl, NRF_CTRL_ACK_PAYLOAD_ENABLED);
     nrf_controller_open_writing_pipe(nrf_ctrl, address_to_write, address_length);
@@ -149,30 +271,34 @@ int main(void)
     uart_send_str("Waiting for commands\r\n");
     uart_send_str("Write command:\r\n");
     while (1) {
-        uint8_t command_length = uart_receive_command((uint8_t*)buffer, ARR_SIZE(buffer)-1);
+        // a full 32 byte payload, tagged commands need the room
+        uint8_t command_length = uart_receive_command((uint8_t*)buffer, ARR_SIZE(buffer));
         if(command_length == 0) {
             continue;
         }
-        uint8_t write_cycles = 50;
-        bool has_write_succeed = false;
-        while(write_cycles && !has_write_succeed) {
-            nrf_controller_start_write(nrf_ctrl, (const uint8_t*)buffer, command_length);
-            has_write_succeed = nrf_controller_finish_write_sync(nrf_ctrl);
-            if(!has_write_succeed) 
-            {
-                _delay_us(4000);
-            }
-            --write_cycles;
+        if(STRING_STARTSWITH(buffer, bulk_command)) {
+            run_bulk_transfer(nrf_ctrl);
+            memset(buffer, 0, command_length);
+            continue;
         }
+        bool has_write_succeed = write_with_backoff(nrf_ctrl, (const uint8_t*)buffer, command_length);
         memset(buffer, 0, command_length);
         bool has_available_ack = nrf_controller_is_message_available(nrf_ctrl, NRF_CTRL_ANY_PIPE);
+        uint8_t payload_size = 0;
         if(has_write_succeed && has_available_ack) {
-            uint8_t payload_size = nrf_controller_get_dynamic_payload_size(nrf_ctrl);
+            payload_size = nrf_controller_get_dynamic_payload_size(nrf_ctrl);
             nrf_controller_read_incoming(nrf_ctrl, (uint8_t*)buffer, payload_size);
+        }
+        // left in the sensor's fifo by a transfer that ended abnormally, binary is no response line
+        const bool is_stray_segment = nrf_bulk_is_segment((const uint8_t*)buffer, payload_size);
+        if(has_write_succeed && has_available_ack && !is_stray_segment) {
             uart_send_str(buffer);
             uart_send_str("\r\n");
             memset(buffer, 0, payload_size);
             
+        } else if(!has_write_succeed) {
+            uart_send_str(is_link_down() ? no_link_resp : no_ack_resp);
+            uart_send_str("\r\n");
         } else {
             uart_send_str("ERROR\r\n");
             memset(buffer, 0, 33);
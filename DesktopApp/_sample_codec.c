@@ -0,0 +1,175 @@
+// Native part of sample_codec.py, which documents the format and keeps the pure Python
+// fallback. Build in place with
+//     python setup.py build_ext --inplace
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <stdint.h>
+#include <string.h>
+
+// dropped count, entry count
+#define BACKLOG_HEADER_LENGTH 3
+// time in ms, raw value, range
+#define BACKLOG_FIRST_ENTRY_LENGTH 7
+// codes are at most 32 bits
+#define VARINT_MAX_SHIFT 28
+
+typedef struct {
+    const uint8_t* data;
+    Py_ssize_t length;
+    Py_ssize_t offset;
+} Reader;
+
+static uint32_t
+reader_get_bytes(Reader* reader, uint8_t count)
+{
+    uint32_t value = 0;
+    for(uint8_t i = 0; i != count; ++i) {
+        value |= (uint32_t)reader->data[reader->offset++] << (8 * i);
+    }
+    return value;
+}
+
+static int
+reader_get_varint(Reader* reader, uint32_t* value)
+{
+    uint32_t result = 0;
+    for(unsigned shift = 0; shift <= VARINT_MAX_SHIFT; shift += 7) {
+        if(reader->offset >= reader->length) {
+            PyErr_SetString(PyExc_ValueError, "truncated varint");
+            return 0;
+        }
+        const uint8_t byte = reader->data[reader->offset++];
+        if(shift == VARINT_MAX_SHIFT && (byte & 0x7F) > (UINT32_MAX >> VARINT_MAX_SHIFT)) {
+            break;
+        }
+        result |= (uint32_t)(byte & 0x7F) << shift;
+        if(byte < 0x80) {
+            *value = result;
+            return 1;
+        }
+    }
+    PyErr_SetString(PyExc_ValueError, "varint over 32 bits");
+    return 0;
+}
+
+static int32_t
+unzigzag(uint32_t code)
+{
+    return (int32_t)(code >> 1) ^ -(int32_t)(code & 1);
+}
+
+static int
+decode_entries(Reader* reader, uint8_t count, uint32_t* times, uint16_t* values, uint8_t* ranges)
+{
+    uint32_t time_ms = reader_get_bytes(reader, 4);
+    int64_t value = reader_get_bytes(reader, 2);
+    uint8_t range = reader_get_bytes(reader, 1);
+    uint32_t step = 0;
+    times[0] = time_ms;
+    values[0] = value;
+    ranges[0] = range;
+    for(uint8_t i = 1; i != count; ++i) {
+        uint32_t code;
+        if(!reader_get_varint(reader, &code)) {
+            return 0;
+        }
+        // mod 2^32 like the sensor, a clock sync may move time either way
+        step += (uint32_t)unzigzag(code);
+        time_ms += step;
+        if(!reader_get_varint(reader, &code)) {
+            return 0;
+        }
+        value += unzigzag(code >> 1);
+        if(value < 0 || value > UINT16_MAX) {
+            PyErr_SetString(PyExc_ValueError, "raw value out of range");
+            return 0;
+        }
+        if(code & 1) {
+            if(reader->offset >= reader->length) {
+                PyErr_SetString(PyExc_ValueError, "truncated range");
+                return 0;
+            }
+            range = reader->data[reader->offset++];
+        }
+        times[i] = time_ms;
+        values[i] = value;
+        ranges[i] = range;
+    }
+    return 1;
+}
+
+static PyObject*
+sample_codec_decode_backlog_columns(PyObject* self, PyObject* args)
+{
+    Py_buffer blob;
+    if(!PyArg_ParseTuple(args, "y*", &blob)) {
+        return NULL;
+    }
+    Reader reader = { blob.buf, blob.len, 0 };
+    const uint16_t dropped = (blob.len >= BACKLOG_HEADER_LENGTH) ? reader_get_bytes(&reader, 2) : 0;
+    const uint8_t count = (blob.len >= BACKLOG_HEADER_LENGTH) ? reader_get_bytes(&reader, 1) : 0;
+    if(blob.len < BACKLOG_HEADER_LENGTH
+            || (count != 0 && blob.len < BACKLOG_HEADER_LENGTH + BACKLOG_FIRST_ENTRY_LENGTH)) {
+        PyBuffer_Release(&blob);
+        PyErr_SetString(PyExc_ValueError, "truncated header");
+        return NULL;
+    }
+    // native byte order, the way array.frombytes takes them
+    PyObject* result = NULL;
+    PyObject* times = PyBytes_FromStringAndSize(NULL, count * sizeof(uint32_t));
+    PyObject* values = PyBytes_FromStringAndSize(NULL, count * sizeof(uint16_t));
+    PyObject* ranges = PyBytes_FromStringAndSize(NULL, count);
+    if(times != NULL && values != NULL && ranges != NULL
+            && (count == 0 || decode_entries(&reader, count, (uint32_t*)PyBytes_AS_STRING(times),
+                (uint16_t*)PyBytes_AS_STRING(values), (uint8_t*)PyBytes_AS_STRING(ranges)))) {
+        result = Py_BuildValue("(HOOO)", dropped, times, values, ranges);
+    }
+    Py_XDECREF(times);
+    Py_XDECREF(values);
+    Py_XDECREF(ranges);
+    PyBuffer_Release(&blob);
+    return result;
+}
+
+static PyObject*
+sample_codec_calibrate(PyObject* self, PyObject* args)
+{
+    Py_buffer raw;
+    double gain_error;
+    double zero_error;
+    unsigned int oversampling_bits;
+    if(!PyArg_ParseTuple(args, "y*ddI", &raw, &gain_error, &zero_error, &oversampling_bits)) {
+        return NULL;
+    }
+    const Py_ssize_t count = raw.len / (Py_ssize_t)sizeof(uint16_t);
+    PyObject* result = PyBytes_FromStringAndSize(NULL, count * sizeof(double));
+    if(result != NULL) {
+        const double scale = 1.0 / (double)((uint64_t)1 << (oversampling_bits & 63));
+        double* calibrated = (double*)PyBytes_AS_STRING(result);
+        for(Py_ssize_t i = 0; i != count; ++i) {
+            uint16_t value;
+            memcpy(&value, (const uint8_t*)raw.buf + i * sizeof(uint16_t), sizeof(value));
+            calibrated[i] = gain_error * (value * scale + zero_error);
+        }
+    }
+    PyBuffer_Release(&raw);
+    return result;
+}
+
+static PyMethodDef sample_codec_methods[] = {
+    {"decode_backlog_columns", sample_codec_decode_backlog_columns, METH_VARARGS,
+        "(dropped, times, values, ranges) of a backlog drain image, columns as bytes of uint32, uint16 and uint8"},
+    {"calibrate", sample_codec_calibrate, METH_VARARGS,
+        "bytes of doubles from a buffer of uint16 raw values, gain_error, zero_error, oversampling_bits"},
+    {NULL, NULL, 0, NULL}
+};
+
+static struct PyModuleDef sample_codec_module = {
+    PyModuleDef_HEAD_INIT, "_sample_codec", NULL, -1, sample_codec_methods
+};
+
+PyMODINIT_FUNC
+PyInit__sample_codec(void)
+{
+    return PyModule_Create(&sample_codec_module);
+}
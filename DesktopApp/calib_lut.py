@@ -0,0 +1,221 @@
+"""Piecewise linear calibration tables of the sensor (calib_lut.h on the sensor side).
+
+A table corrects the native 10 bit scale of the AVcc range before the zero and gain error
+are applied. It is fitted from reference measurements, pairs of a native reading (averaged
+readings may have a fraction) and the value a reference instrument showed at the same time:
+    python calib_lut.py points.csv --gain 0.52 --zero -3
+    python calib_lut.py points.csv --device /dev/ttyUSB0 --config 0 --write
+The second form takes zero and gain error of the configuration from the sensor and with
+--write stores the table there. python calib_lut.py --self-test checks the table math."""
+import argparse
+import csv
+import json
+import math
+import sys
+
+SEGMENT_BITS = 6
+KNOT_COUNT = 1024 >> SEGMENT_BITS
+FRACTION_BITS = 6
+MAX_SHIFT = 10
+KNOT_MIN = -128
+KNOT_MAX = 127
+# weight of the second differences, keeps knots without nearby points on the line of their neighbours
+SMOOTHING = 1e-3
+
+def apply(lut, raw, oversampling_bits = 0):
+    """Integer copy of calib_lut_apply: raw reading of oversampling_bits extra bits plus its
+    correction, in 1/2^FRACTION_BITS native lsb"""
+    (shift, knots) = lut
+    segment_bits = SEGMENT_BITS + oversampling_bits
+    segment = raw >> segment_bits
+    position = raw & ((1 << segment_bits) - 1)
+    if segment >= KNOT_COUNT:
+        segment = KNOT_COUNT - 1
+        position = 1 << segment_bits
+    start = 0 if segment == 0 else knots[segment - 1] << shift
+    end = knots[segment] << shift
+    correction = start + (((end - start) * position) >> segment_bits)
+    return ((raw << FRACTION_BITS) >> oversampling_bits) + correction
+
+def calibrate_raw_value(raw_value, gain_error, zero_error, lut, oversampling_bits = 0):
+    """procedures.calibrate_raw_value of an AVcc range reading with the table applied, None leaves it out;
+    raw_value may have a fraction like aggregated means do"""
+    if lut == None:
+        return gain_error * (raw_value / (1 << oversampling_bits) + zero_error)
+    if isinstance(raw_value, int):
+        corrected = apply(lut, raw_value, oversampling_bits)
+    else:
+        # more bits below the reading give the same result for whole readings
+        corrected = apply(lut, int(round(raw_value * (1 << FRACTION_BITS))), oversampling_bits + FRACTION_BITS)
+    return gain_error * (corrected / (1 << FRACTION_BITS) + zero_error)
+
+def get_slope(lut, native_value):
+    """Derivative of the corrected native scale at native_value, scales spreads like variances"""
+    (shift, knots) = lut
+    segment = min(max(int(native_value), 0) >> SEGMENT_BITS, KNOT_COUNT - 1)
+    start = 0 if segment == 0 else knots[segment - 1] << shift
+    end = knots[segment] << shift
+    return 1 + (end - start) / (1 << (FRACTION_BITS + SEGMENT_BITS))
+
+def _solve(matrix, vector):
+    """Gaussian elimination with partial pivoting, the system is small and well conditioned"""
+    size = len(vector)
+    rows = [matrix[i][:] + [vector[i]] for i in range(size)]
+    for column in range(size):
+        pivot = max(range(column, size), key = lambda row: abs(rows[row][column]))
+        (rows[column], rows[pivot]) = (rows[pivot], rows[column])
+        for row in range(column + 1, size):
+            factor = rows[row][column] / rows[column][column]
+            for k in range(column, size + 1):
+                rows[row][k] -= factor * rows[column][k]
+    result = [0.0] * size
+    for row in reversed(range(size)):
+        remainder = rows[row][size] - sum(rows[row][k] * result[k] for k in range(row + 1, size))
+        result[row] = remainder / rows[row][row]
+    return result
+
+def fit_corrections(points, gain_error, zero_error):
+    """Least squares corrections in native lsb at the knots, points are (native reading, reference value)"""
+    # knot 0 of the sensor sits at native value 64, the correction at 0 is fixed to 0
+    matrix = [[0.0] * KNOT_COUNT for _ in range(KNOT_COUNT)]
+    vector = [0.0] * KNOT_COUNT
+    for (raw, reference) in points:
+        residual = reference / gain_error - zero_error - raw
+        segment = min(int(raw) >> SEGMENT_BITS, KNOT_COUNT - 1)
+        position = raw / (1 << SEGMENT_BITS) - segment
+        weights = [(segment - 1, 1.0 - position), (segment, position)]
+        weights = [(knot, weight) for (knot, weight) in weights if knot >= 0]
+        for (knot, weight) in weights:
+            vector[knot] += weight * residual
+            for (other, other_weight) in weights:
+                matrix[knot][other] += weight * other_weight
+    # second differences over the knots with the fixed 0 in front
+    for center in range(KNOT_COUNT - 1):
+        terms = [(center - 1, 1.0), (center, -2.0), (center + 1, 1.0)]
+        terms = [(knot, weight) for (knot, weight) in terms if knot >= 0]
+        for (knot, weight) in terms:
+            for (other, other_weight) in terms:
+                matrix[knot][other] += SMOOTHING * len(points) * weight * other_weight
+    return _solve(matrix, vector)
+
+def quantize(corrections):
+    """(shift, knots) of the finest scale that holds every correction"""
+    largest = max(abs(value) for value in corrections) * (1 << FRACTION_BITS)
+    for shift in range(MAX_SHIFT + 1):
+        if largest / (1 << shift) <= KNOT_MAX:
+            knots = [max(KNOT_MIN, min(KNOT_MAX, round(value * (1 << FRACTION_BITS) / (1 << shift))))
+                for value in corrections]
+            return (shift, knots)
+    raise ValueError("corrections exceed the table range")
+
+def rms_error(points, gain_error, zero_error, lut):
+    """In reference units, readings with a fraction are taken as oversampled by FRACTION_BITS"""
+    total = 0.0
+    for (raw, reference) in points:
+        oversampled = int(round(raw * (1 << FRACTION_BITS)))
+        value = calibrate_raw_value(oversampled, gain_error, zero_error, lut, FRACTION_BITS)
+        total += (value - reference) ** 2
+    return math.sqrt(total / len(points))
+
+def fit(points, gain_error, zero_error):
+    """Returns (shift, knots) ready for procedures.conf_set_lut"""
+    return quantize(fit_corrections(points, gain_error, zero_error))
+
+def read_points(filename):
+    """CSV rows of native reading, reference value; rows that are not numbers are skipped"""
+    points = []
+    with open(filename, newline = '') as file:
+        for row in csv.reader(file):
+            try:
+                points.append((float(row[0]), float(row[1])))
+            except (ValueError, IndexError) as _:
+                continue
+    return points
+
+def _read_slot_calibration(reader, index):
+    import procedures as proc
+    (zero_error, zero_state) = proc.conf_get_zero_error_value(reader, index)
+    (gain_error, gain_state) = proc.conf_get_gain_error_value(reader, index)
+    if zero_state != proc.DATA_READ_SUCCESS or gain_state != proc.DATA_READ_SUCCESS:
+        raise ValueError("Cannot read the calibration of configuration " + str(index))
+    return (gain_error, zero_error)
+
+def _write_lut(reader, index, lut):
+    import procedures as proc
+    if proc.CMD_SUCCESS != proc.conf_set_lut(reader, index, lut):
+        raise ValueError("Cannot set the table of configuration " + str(index))
+    if proc.CMD_SUCCESS != proc.conf_commit_lut(reader, index):
+        raise ValueError("Cannot commit the table of configuration " + str(index))
+
+def main(argv = None):
+    # procedures uses the table math above, the sensor access is only imported here
+    import headless
+    import sensor_utils
+    parser = argparse.ArgumentParser(description = "Fits the calibration table of a sensor configuration")
+    parser.add_argument('points', help = "CSV of native reading, reference value")
+    parser.add_argument('--gain', type = float, help = "gain error, read from the sensor by default")
+    parser.add_argument('--zero', type = float, help = "zero error, read from the sensor by default")
+    parser.add_argument('--device', help = "serial port of the gateway")
+    parser.add_argument('--config', type = int, default = 0, choices = range(headless.CONFIG_COUNT))
+    parser.add_argument('--write', action = 'store_true', help = "store the table on the sensor")
+    args = parser.parse_args(argv)
+    points = read_points(args.points)
+    if len(points) == 0:
+        print("No reference points in " + args.points, file = sys.stderr)
+        return 1
+    if (args.gain == None or args.zero == None or args.write) and args.device == None:
+        print("--device is needed to read the calibration or to write the table", file = sys.stderr)
+        return 1
+
+    session = headless.SensorSession(args.device) if args.device != None else None
+    try:
+        if session != None:
+            session.connect()
+        (gain_error, zero_error) = (args.gain, args.zero)
+        if gain_error == None or zero_error == None:
+            (gain_error, zero_error) = _read_slot_calibration(session.reader, args.config)
+        lut = fit(points, gain_error, zero_error)
+        print(json.dumps({'shift': lut[0], 'knots': lut[1],
+            'rms_error_linear': rms_error(points, gain_error, zero_error, None),
+            'rms_error_table': rms_error(points, gain_error, zero_error, lut)}, indent = 2))
+        if args.write:
+            _write_lut(session.reader, args.config, lut)
+    except (ValueError, headless.SensorError, sensor_utils.SerialPortException) as e:
+        print(str(e), file = sys.stderr)
+        return 1
+    finally:
+        if session != None:
+            session.close()
+    return 0
+
+if __name__ == "__main__":
+    TEST_KNOTS = [10, -20] + [i - 8 for i in range(2, KNOT_COUNT - 1)] + [30]
+
+    def verify_apply():
+        lut = (2, TEST_KNOTS)
+        # (raw, oversampling bits, result of calib_lut_apply on the sensor)
+        expected = [
+            (0, 0, 0), (32, 0, 2068), (64, 0, 4136), (96, 0, 6124), (128, 0, 8112),
+            (1000, 0, 64084), (1023, 0, 65590),
+            # past the last knot
+            (1024, 0, 65656),
+            (64 << 6, 6, 4136), (96 << 6, 6, 6124), ((96 << 6) + 37, 6, 6159), (1023 << 6, 6, 65590),
+            (65535, 6, 65654),
+        ]
+        for (raw, oversampling_bits, result) in expected:
+            assert apply(lut, raw, oversampling_bits) == result
+        # a fraction of a reading gives the same as the oversampled reading
+        assert calibrate_raw_value(96 + 37 / 64, 1.0, 0.0, lut) == calibrate_raw_value((96 << 6) + 37, 1.0, 0.0, lut, 6)
+        assert calibrate_raw_value(100, 0.5, -3.0, None) == 48.5
+        print("test passed")
+
+    def verify_quantize():
+        for (shift, knots) in [(0, [127, -127] + [0] * (KNOT_COUNT - 2)), (3, [100] + TEST_KNOTS[1:])]:
+            corrections = [knot * (1 << shift) / (1 << FRACTION_BITS) for knot in knots]
+            assert quantize(corrections) == (shift, knots)
+        print("test passed")
+
+    if sys.argv[1:] != ['--self-test']:
+        sys.exit(main())
+    verify_apply()
+    verify_quantize()
@@ -0,0 +1,237 @@
+"""Daemon owning several gateways, each streamed by its own thread into rotating recordings.
+
+Configuration is a JSON file:
+    {"socket": "/run/light_sensor.sock", "output_dir": "/var/lib/light_sensor",
+     "segment_seconds": 3600,
+     "gateways": [{"name": "lab1", "device": "/dev/ttyUSB0", "config": 0}]}
+
+Queries are newline terminated JSON objects sent over the UNIX socket, every
+request gets a single line JSON reply:
+    {"cmd": "status"}
+    {"cmd": "current", "gateway": "lab1"}
+    {"cmd": "range", "gateway": "lab1", "start": 1700000000, "end": 1700000600, "bucket": 60}
+Times are unix seconds. Range queries see samples up to FLUSH_INTERVAL_SECONDS old,
+current values are live."""
+import argparse
+import glob
+import json
+import logging
+import math
+import os
+import signal
+import socketserver
+import sys
+import threading
+import time
+import headless
+import recording
+import sensor_utils
+
+DEFAULT_SEGMENT_SECONDS = 3600
+FLUSH_INTERVAL_SECONDS = 5
+RECONNECT_DELAY_SECONDS = 10
+RANGE_SAMPLES_LIMIT = 100000
+
+class GatewayWorker(threading.Thread):
+
+    def __init__(self, name, device, config_index, output_dir, segment_seconds, stop_event):
+        super().__init__(name = name, daemon = True)
+        self.device = device
+        self.config_index = config_index
+        self.output_dir = output_dir
+        self.segment_seconds = segment_seconds
+        self.stop_event = stop_event
+        self.state_lock = threading.Lock()
+        self.state = 'starting'
+        self.latest = None
+        self.samples = 0
+        self.failures = 0
+        self.last_error = None
+
+    def get_segments(self):
+        return sorted(glob.glob(os.path.join(self.output_dir, glob.escape(self.name) + '-*.lsrec')))
+
+    def get_status(self):
+        with self.state_lock:
+            status = {'gateway': self.name, 'device': self.device, 'config_index': self.config_index,
+                'state': self.state, 'samples': self.samples, 'failures': self.failures,
+                'last_error': self.last_error}
+            if self.latest != None:
+                (status['value'], status['timestamp']) = self.latest
+            return status
+
+    def _set_state(self, state, error = None):
+        with self.state_lock:
+            self.state = state
+            if error != None:
+                self.failures += 1
+                self.last_error = error
+
+    def _record_sample(self, value, timestamp):
+        with self.state_lock:
+            self.latest = (value, timestamp)
+            self.samples += 1
+
+    def _stream_segment(self, session, header):
+        filename = os.path.join(self.output_dir, '{}-{}.lsrec'.format(self.name, int(time.time())))
+        header = dict(header, created = time.time(), gateway = self.name, device = self.device)
+        writer = recording.RecordingWriter(open(filename, 'wb'), header)
+        last_flush = time.monotonic()
+        def on_sample(value, timestamp):
+            nonlocal last_flush
+            self._record_sample(value, timestamp)
+            if time.monotonic() - last_flush >= FLUSH_INTERVAL_SECONDS:
+                writer.flush()
+                last_flush = time.monotonic()
+        try:
+            session.stream(self.segment_seconds, writer, on_sample, self.stop_event.is_set)
+        finally:
+            writer.close()
+
+    def _reconnect_later(self, level, reason):
+        self._set_state('reconnecting', reason)
+        headless.log_event(level, 'gateway_failed', device = self.device, reason = reason)
+        self.stop_event.wait(RECONNECT_DELAY_SECONDS)
+
+    def run(self):
+        # status must not keep showing streaming once the thread is gone
+        final_state = 'failed'
+        try:
+            while not self.stop_event.is_set():
+                try:
+                    with headless.SensorSession(self.device) as session:
+                        session.select_config(self.config_index)
+                        header = session.read_config(self.config_index)
+                        self._set_state('streaming')
+                        while not self.stop_event.is_set():
+                            self._stream_segment(session, header)
+                except (headless.SensorError, sensor_utils.SerialPortException, OSError) as e:
+                    self._reconnect_later(logging.WARNING, str(e))
+                except Exception as e:
+                    # garbled lines from the gateway, like a full read buffer or invalid UTF-8
+                    self._reconnect_later(logging.ERROR, '{}: {}'.format(type(e).__name__, e))
+            final_state = 'stopped'
+        finally:
+            self._set_state(final_state)
+
+    def query_range(self, start_ms, end_ms, bucket_ms = None):
+        samples = []
+        buckets = []
+        for filename in self.get_segments():
+            try:
+                reader = recording.RecordingReader(filename)
+            except recording.RecordingFormatException:
+                continue
+            try:
+                time_range = reader.time_range()
+                if time_range == None or time_range[1] < start_ms or time_range[0] >= end_ms:
+                    continue
+                if bucket_ms != None:
+                    buckets.extend(reader.bucket_stats(start_ms, end_ms, bucket_ms))
+                    continue
+                for (timestamp, value, status) in reader.samples(start_ms, end_ms):
+                    if len(samples) >= RANGE_SAMPLES_LIMIT:
+                        break
+                    samples.append((timestamp / 1000, None if math.isnan(value) else value,
+                        recording.STATUS_NAMES.get(status, status)))
+            finally:
+                reader.close()
+        if bucket_ms == None:
+            return {'samples': samples, 'truncated': len(samples) >= RANGE_SAMPLES_LIMIT}
+        return {'buckets': [_bucket_to_json(bucket) for bucket in _merge_buckets(buckets)]}
+
+def _merge_buckets(buckets):
+    merged = {}
+    for bucket in buckets:
+        if bucket.start not in merged:
+            merged[bucket.start] = bucket
+        else:
+            merged[bucket.start].add_bucket(bucket)
+    return [merged[key] for key in sorted(merged)]
+
+def _bucket_to_json(bucket):
+    if bucket.count == 0:
+        return {'start': bucket.start / 1000, 'count': 0}
+    return {'start': bucket.start / 1000, 'count': bucket.count, 'min': bucket.min_value,
+        'max': bucket.max_value, 'mean': bucket.mean()}
+
+class QueryHandler(socketserver.StreamRequestHandler):
+
+    def handle(self):
+        for line in self.rfile:
+            try:
+                response = self.server.daemon_state.handle_query(json.loads(line.decode('UTF-8')))
+            except (ValueError, KeyError, TypeError) as e:
+                response = {'error': 'bad request: ' + str(e)}
+            self.wfile.write(json.dumps(response).encode('UTF-8') + b'\n')
+
+class QueryServer(socketserver.ThreadingMixIn, socketserver.UnixStreamServer):
+    daemon_threads = True
+
+class GatewayDaemon:
+
+    def __init__(self, config):
+        self.stop_event = threading.Event()
+        self.socket_path = config['socket']
+        output_dir = config['output_dir']
+        segment_seconds = config.get('segment_seconds', DEFAULT_SEGMENT_SECONDS)
+        os.makedirs(output_dir, exist_ok = True)
+        self.workers = {}
+        for gateway in config['gateways']:
+            self.workers[gateway['name']] = GatewayWorker(gateway['name'], gateway['device'],
+                gateway.get('config', 0), output_dir, segment_seconds, self.stop_event)
+
+    def handle_query(self, request):
+        command = request['cmd']
+        if command == 'status':
+            return {'gateways': [worker.get_status() for worker in self.workers.values()]}
+        if command not in ('current', 'range'):
+            return {'error': 'unknown command'}
+        worker = self.workers.get(request.get('gateway'))
+        if worker == None:
+            return {'error': 'unknown gateway'}
+        if command == 'current':
+            return worker.get_status()
+        start_ms = int(float(request['start']) * 1000)
+        end_ms = int(float(request['end']) * 1000)
+        bucket_ms = int(float(request['bucket']) * 1000) if 'bucket' in request else None
+        if bucket_ms != None and bucket_ms <= 0:
+            return {'error': 'bucket must be positive'}
+        return worker.query_range(start_ms, end_ms, bucket_ms)
+
+    def serve(self):
+        if os.path.exists(self.socket_path):
+            os.unlink(self.socket_path)
+        server = QueryServer(self.socket_path, QueryHandler)
+        server.daemon_state = self
+        for worker in self.workers.values():
+            worker.start()
+        headless.log_event(logging.INFO, 'daemon_started', socket = self.socket_path,
+            gateways = list(self.workers))
+        def stop(*args):
+            self.stop_event.set()
+            threading.Thread(target = server.shutdown).start()
+        signal.signal(signal.SIGTERM, stop)
+        signal.signal(signal.SIGINT, stop)
+        try:
+            server.serve_forever()
+        finally:
+            server.server_close()
+            os.unlink(self.socket_path)
+            self.stop_event.set()
+            for worker in self.workers.values():
+                worker.join()
+            headless.log_event(logging.INFO, 'daemon_stopped')
+
+def main(argv = None):
+    parser = argparse.ArgumentParser(description = "Multi-gateway light sensor daemon")
+    parser.add_argument('config', help = "JSON configuration file")
+    parser.add_argument('--log-level', default = 'INFO', choices = ['DEBUG', 'INFO', 'WARNING', 'ERROR'])
+    args = parser.parse_args(argv)
+    headless.configure_json_logging(getattr(logging, args.log_level))
+    with open(args.config) as config_file:
+        GatewayDaemon(json.load(config_file)).serve()
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
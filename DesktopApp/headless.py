@@ -0,0 +1,175 @@
+"""Headless access to the light sensor for unattended captures.
+
+Can be used as a library (SensorSession, capture) or from the command line:
+    python headless.py --device /dev/ttyUSB0 dump-config
+    python headless.py --device /dev/ttyUSB0 capture --config 0 --duration 60 --output run.lsrec
+Every event is logged to stderr as a single line JSON object."""
+import argparse
+import json
+import logging
+import sys
+import time
+import procedures as proc
+import recording
+import sensor_utils
+
+CONFIG_COUNT = 5
+
+log = logging.getLogger('light_sensor')
+
+class SensorError(Exception):
+    pass
+
+class JsonLogFormatter(logging.Formatter):
+
+    def format(self, record):
+        entry = {'time': record.created, 'level': record.levelname, 'event': record.getMessage()}
+        if record.threadName != 'MainThread':
+            entry['thread'] = record.threadName
+        entry.update(getattr(record, 'fields', {}))
+        return json.dumps(entry)
+
+def log_event(level, event, **fields):
+    log.log(level, event, extra = {'fields': fields})
+
+def configure_json_logging(level = logging.INFO, stream = sys.stderr):
+    handler = logging.StreamHandler(stream)
+    handler.setFormatter(JsonLogFormatter())
+    log.handlers = [handler]
+    log.setLevel(level)
+    log.propagate = False
+
+def _read_value(result, what):
+    (value, state) = result
+    if state != proc.DATA_READ_SUCCESS:
+        raise SensorError("Cannot read " + what)
+    return value
+
+class SensorSession:
+
+    def __init__(self, device):
+        self.device = device
+        self.serial = None
+        self.reader = None
+
+    def __enter__(self):
+        self.connect()
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def connect(self):
+        (self.serial, self.reader) = sensor_utils.open_serial(self.device)
+        proc.clear_command_ids(self.reader)
+        # stop previous meas if error occured during meas
+        proc.meas_stop(self.reader)
+        if proc.nop(self.reader) != proc.CMD_SUCCESS:
+            self.close()
+            raise SensorError("Sensor does not respond on " + self.device)
+        log_event(logging.INFO, 'connected', device = self.device)
+
+    def close(self):
+        if self.serial != None:
+            self.serial.close()
+            self.serial = None
+            self.reader = None
+            log_event(logging.INFO, 'disconnected', device = self.device)
+
+    def read_config(self, index):
+        config = {'config_index': index}
+        config['wavelength'] = _read_value(proc.conf_get_wavelength_value(self.reader, index), 'wavelength')
+        config['zero_error'] = _read_value(proc.conf_get_zero_error_value(self.reader, index), 'zero error')
+        config['gain_error'] = _read_value(proc.conf_get_gain_error_value(self.reader, index), 'gain error')
+        report = _read_value(proc.conf_get_report(self.reader, index), 'report settings')
+        config['report'] = dict(zip(('mode', 'deadband_abs', 'deadband_rel', 'hysteresis', 'heartbeat_sec'), report))
+        return config
+
+    def dump_config(self):
+        calibrated = _read_value(proc.int_ref_is_calibrated(self.reader), 'calibration status')
+        return {'int_ref_calibrated': calibrated,
+            'configs': [self.read_config(i) for i in range(CONFIG_COUNT)]}
+
+    def select_config(self, index):
+        if proc.CMD_SUCCESS != proc.conf_select(self.reader, index):
+            raise SensorError("Cannot select configuration " + str(index))
+        log_event(logging.INFO, 'config_selected', config_index = index)
+
+    def stream(self, duration, writer = None, on_sample = None, should_stop = None):
+        """Measures for duration seconds or until should_stop returns True, returns counters of the run"""
+        counters = {'samples': 0, 'no_value': 0, 'no_change': 0}
+        if proc.CMD_SUCCESS != proc.time_sync(self.reader):
+            raise SensorError("Cannot synchronize sensor clock")
+        if proc.CMD_SUCCESS != proc.meas_start(self.reader):
+            raise SensorError("Cannot start measurement")
+        log_event(logging.INFO, 'measurement_started', duration = duration)
+        deadline = time.monotonic() + duration
+        try:
+            while time.monotonic() < deadline and not (should_stop != None and should_stop()):
+                (sample, status) = proc.meas_get_sample(self.reader)
+                if status == proc.GET_VAL_NO_VAL:
+                    counters['no_value'] += 1
+                    continue
+                if status == proc.GET_VAL_NO_CHANGE:
+                    counters['no_change'] += 1
+                    continue
+                if status == proc.GET_VAL_VOL_CHECK_FAILURE:
+                    if writer != None:
+                        writer.append(time.time(), None, recording.STATUS_VOL_CHECK_FAILURE)
+                    raise SensorError("Voltage check failed")
+                if status != proc.GET_VAL_SUCCESS or sample == None:
+                    if writer != None:
+                        writer.append(time.time(), None, recording.STATUS_ERROR)
+                    raise SensorError("Measurement failed with status " + str(status))
+                (value, timestamp) = sample
+                counters['samples'] += 1
+                if writer != None:
+                    writer.append(timestamp, value)
+                if on_sample != None:
+                    on_sample(value, timestamp)
+                log_event(logging.DEBUG, 'sample', value = value, timestamp = timestamp)
+        finally:
+            proc.meas_stop(self.reader)
+            log_event(logging.INFO, 'measurement_stopped', **counters)
+        return counters
+
+def capture(device, config_index, duration, filename):
+    """Streams config_index of the sensor on device for duration seconds into a recording"""
+    with SensorSession(device) as session:
+        session.select_config(config_index)
+        header = session.read_config(config_index)
+        header['created'] = time.time()
+        with open(filename, 'wb') as file:
+            writer = recording.RecordingWriter(file, header)
+            try:
+                return session.stream(duration, writer)
+            finally:
+                writer.close()
+
+def main(argv = None):
+    parser = argparse.ArgumentParser(description = "Headless light sensor access")
+    parser.add_argument('--device', required = True, help = "serial port of the gateway")
+    parser.add_argument('--log-level', default = 'INFO', choices = ['DEBUG', 'INFO', 'WARNING', 'ERROR'])
+    commands = parser.add_subparsers(dest = 'command', required = True)
+    commands.add_parser('dump-config', help = "print all configurations as JSON")
+    capture_parser = commands.add_parser('capture', help = "record measurements to a file")
+    capture_parser.add_argument('--config', type = int, required = True, choices = range(CONFIG_COUNT))
+    capture_parser.add_argument('--duration', type = float, required = True, help = "seconds")
+    capture_parser.add_argument('--output', required = True, help = "recording file")
+    args = parser.parse_args(argv)
+    configure_json_logging(getattr(logging, args.log_level))
+
+    try:
+        if args.command == 'dump-config':
+            with SensorSession(args.device) as session:
+                print(json.dumps(session.dump_config(), indent = 2))
+        elif args.command == 'capture':
+            counters = capture(args.device, args.config, args.duration, args.output)
+            log_event(logging.INFO, 'capture_finished', output = args.output, **counters)
+    except (SensorError, sensor_utils.SerialPortException) as e:
+        log_event(logging.ERROR, 'failed', reason = str(e))
+        return 1
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
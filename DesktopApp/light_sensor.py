@@ -1,4 +1,3 @@
-import serial as pyserial
 import tkinter
 import tkinter.ttk as ttk
 import tkinter.messagebox as mb
@@ -6,6 +5,8 @@ import threading
 import time
 import procedures as proc
 import sensor_utils
+import recording
+import live_plot
 import tkinter.filedialog as filedialog
 import tkinter.messagebox as tkmb
 #import traceback
@@ -13,13 +14,12 @@ import tkinter.messagebox as tkmb
 
 TREEVIEW_VALUE_UNREAD = 'Not Read'
 TREEVIEW_VALUE_UNSET = "Unset"
+SAMPLE_QUEUE_CAPACITY = 4096
+SAMPLE_BATCH_LIMIT = 1024
 
 class CommunicationException(Exception):
     pass
 
-class SerialPortException(Exception):
-    pass
-
 class IntVolCheckFailedException(Exception):
     pass
 
@@ -98,33 +98,14 @@ class ParametersRow:
         
         
 
-def open_serial(device):
-    serial_port = pyserial.Serial()
-    try:
-        serial_port.port = device
-        serial_port.baudrate=9600
-        timeout = 4
-        # FTDI avoid cached values on uart
-        serial_port.timeout = 0.8
-        serial_port.open()
-        serial_port.read(4000)
-        serial_port.timeout = timeout
-
-        serial_wrapper = sensor_utils.StreamWrapper(serial_port, 100)
-        return (serial_port, serial_wrapper)
-    except:
-        serial_port.close()
-        raise SerialPortException("Cannot connect with serial device: " + str(device))
-
 class MeasurementThread(threading.Thread):
 
     def __init__(self, device):
         super().__init__()
-        self.displayed_value_lock = threading.Lock()
         self.exit_lock = threading.Lock()
         self.should_exit_thread = False
-        self.displayed_value = None
         self.device = device
+        self.samples = sensor_utils.SampleQueue(SAMPLE_QUEUE_CAPACITY)
 
     def get_should_exit(self):
         self.exit_lock.acquire()
@@ -152,30 +133,22 @@ class MeasurementThread(threading.Thread):
         finally:
             self.exit_lock.release()
 
-    def set_displayed_value(self, value):
-        self.displayed_value_lock.acquire()
-        try:
-            self.displayed_value = value
-        finally:
-            self.displayed_value_lock.release()
+    def take_samples(self):
+        return self.samples.take_batch(SAMPLE_BATCH_LIMIT)
+
+    def get_sample_stats(self):
+        return self.samples.get_stats()
 
-    def get_displayed_value(self):
-        self.displayed_value_lock.acquire()
-        try:
-            return self.displayed_value
-        finally:
-            self.displayed_value_lock.release()
-     
     def get_save_file(self):
         return self.save_file if hasattr(self, 'save_file') else None
 
     def set_save_file(self, file):
         self.save_file = file
     
-    def try_write_value_to_save_file(self, value):
-        if self.get_save_file() == None or value == None:
+    def try_write_value_to_save_file(self, value, timestamp, status = recording.STATUS_OK):
+        if self.get_save_file() == None:
             return
-        self.get_save_file().write(str(value) + '\n')
+        self.get_save_file().append(timestamp, value, status)
     
     def get_recored_error(self):
         if not hasattr(self, 'recorded_error'):
@@ -195,23 +168,28 @@ class MeasurementThread(threading.Thread):
         (serial, reader) = self.device
         should_clear_meas = False
         try:
+            if proc.CMD_SUCCESS != proc.time_sync(reader):
+                self.recorded_error = "Cannot synchronize sensor clock"
+                return
             if proc.CMD_SUCCESS != proc.meas_start(reader):
                 self.recorded_error = "Cannot start measurement"
                 return
             should_clear_meas = True
             while not self.get_should_exit():
-                (value, status) = proc.meas_get_val(reader)
-                if status == proc.GET_VAL_NO_VAL:
+                (sample, status) = proc.meas_get_sample(reader)
+                if status == proc.GET_VAL_NO_VAL or status == proc.GET_VAL_NO_CHANGE:
                     continue
                 if status == proc.GET_VAL_VOL_CHECK_FAILURE:
+                    self.try_write_value_to_save_file(None, time.time(), recording.STATUS_VOL_CHECK_FAILURE)
                     self.recorded_error = "Voltage check failed. Please, check supply voltage."
                     return
-                if status != proc.GET_VAL_SUCCESS or value == None:
+                if status != proc.GET_VAL_SUCCESS or sample == None:
+                    self.try_write_value_to_save_file(None, time.time(), recording.STATUS_ERROR)
                     self.recorded_error = "Unknown error occured during measurement. Check if all parameters are applied"
                     return
-                
-                self.set_displayed_value(value)
-                self.try_write_value_to_save_file(value)
+                (value, timestamp) = sample
+                self.samples.push((timestamp, value))
+                self.try_write_value_to_save_file(value, timestamp)
         finally:
             if should_clear_meas:
                 proc.meas_stop(reader)
@@ -242,9 +220,9 @@ class ApplicationController:
     
     def guarded_open_serial(self, device_name):
         try:
-            (serial, reader) = open_serial(device_name)
+            (serial, reader) = sensor_utils.open_serial(device_name)
             return (serial, reader)
-        except SerialPortException:
+        except sensor_utils.SerialPortException:
             self.get_gui().dialog_error("Cannot open device: " + device_name + ". Please, check connection")
             return None
     
@@ -425,6 +403,7 @@ class ApplicationController:
         (serial, reader) = opened_serial
         try:
             self.device_name = device_txt
+            proc.clear_command_ids(reader)
             # stop previous meas if error occured during meas
             proc.meas_stop(reader)
             if proc.nop(reader) != proc.CMD_SUCCESS:
@@ -447,7 +426,7 @@ class ApplicationController:
                 self.data_model[i].get_gain_error().mark_unread()
                 self.data_model[i].get_zero_error().mark_unread()
             self.get_gui().notebook_enable()
-        except SerialPortException:
+        except sensor_utils.SerialPortException:
             self.get_gui().dialog_error("Cannot find specified device: " + device_txt + ". Please, check connection.")
         finally:
             serial.close()
@@ -500,19 +479,42 @@ class ApplicationController:
             return None
         return self.value_setter
 
+    def get_stats_setter(self):
+        if not hasattr(self, 'stats_setter'):
+            return None
+        return self.stats_setter
+
+    def get_live_plot(self):
+        if not hasattr(self, 'live_plot'):
+            return None
+        return self.live_plot
+
     def get_meas_reader(self):
         if not hasattr(self, 'meas_reader'):
             return None
         return self.meas_reader
     
+    def get_calibration_snapshot(self, idx):
+        row = self.data_model[idx]
+        snapshot = {'config_index': idx, 'created': time.time()}
+        parameters = [('wavelength', row.get_wavelength()), ('zero_error', row.get_zero_error()),
+            ('gain_error', row.get_gain_error())]
+        for (name, parameter) in parameters:
+            snapshot[name] = parameter.get() if parameter.flag == Parameter.PRESENT else None
+        return snapshot
+
     def clear_measurment(self):
         self.filename = None
         self.value_setter = None
+        self.live_plot = None
+        self.stats_setter = None
         
-    def handle_start_measurement(self, idx, filename, value_setter):
+    def handle_start_measurement(self, idx, filename, value_setter, plot, stats_setter):
         if self.get_meas_reader() != None:
             return
         self.value_setter = value_setter
+        self.stats_setter = stats_setter
+        self.live_plot = plot
         self.filename = filename
         opened_serial = self.guarded_open_serial(self.device_name)
         if opened_serial == None:
@@ -530,27 +532,35 @@ class ApplicationController:
         try:
             self.meas_reader = MeasurementThread(opened_serial)
             if filename != None:
-                file = open(filename, 'w+')
-                self.meas_reader.set_save_file(file)
+                file = open(filename, 'wb')
+                writer = recording.RecordingWriter(file, self.get_calibration_snapshot(idx))
+                self.meas_reader.set_save_file(writer)
                 
         except IOError:
             self.get_gui().dialog_error("Cannot open filename: " + filename + ". Measurement stopped")
             self.meas_reader = None
             return
+        plot.clear()
+        plot.start()
         self.meas_reader.start()
         self.get_gui().after(50, self.handle_meas_reader_update)
     
     def handle_meas_reader_update(self):
         if self.get_meas_reader() == None:
             return
+        samples = self.get_meas_reader().take_samples()
+        if len(samples) != 0:
+            self.get_value_setter()(str(samples[-1][1]))
+            self.get_live_plot().add_samples(samples)
+        self.get_stats_setter()(self.get_meas_reader().get_sample_stats())
         if not self.get_meas_reader().is_alive():
             meas_error = self.get_meas_reader().finish_measurement()
             if meas_error != None:
                 self.get_gui().dialog_error(meas_error)
             self.get_value_setter()("--")
+            self.get_live_plot().stop()
             self.meas_reader = None
             return
-        self.get_value_setter()(str(self.get_meas_reader().get_displayed_value()))
         self.get_gui().after(100, self.handle_meas_reader_update)
     
     def handle_stop_measurement(self):
@@ -561,6 +571,7 @@ class ApplicationController:
             self.get_gui().dialog_error("After requesting to finish measurement error has occured: " + str(result))
         self.meas_reader = None
         self.get_value_setter()("--")
+        self.get_live_plot().stop()
     
     def handle_application_close(self):
         if self.get_meas_reader() == None:
@@ -822,10 +833,14 @@ class MainFrame(ttk.Frame):
         lbl_value = ttk.Label(value_frame)
         def set_value(value):
             lbl_value.config(text = value)
+        lbl_stats = ttk.Label(value_frame)
+        def set_stats(stats):
+            lbl_stats.config(text = "Samples: {} Dropped: {} Queue peak: {}/{}".format(
+                stats['pushed'], stats['dropped'], stats['high_water'], stats['capacity']))
         
         def start_measurement_callback():
             filename = entry_file.get() if intvar_save_to_file.get() == 1 else None
-            self.app_controller.handle_start_measurement(int(iid), filename, set_value)
+            self.app_controller.handle_start_measurement(int(iid), filename, set_value, plot, set_stats)
             
         start_button.config(command = start_measurement_callback)
         start_button.grid(row = 5, column = 0, padx = 1, pady = 1, sticky = tkinter.E)
@@ -844,6 +859,10 @@ class MainFrame(ttk.Frame):
         lbl_value.grid(row = 0, column = 1)
         lbl_value.config(font = ("Arial", 24))
         set_value("--")
+        lbl_stats.grid(row = 1, column = 1)
+        
+        plot = live_plot.LivePlot(self.tab_measurement)
+        plot.grid(row = 4, column = 0, columnspan = 4, padx = 1, pady = 1, sticky = tkinter.NSEW)
         
     def toggle_save_to_file_option(self, value, objects_to_toggle):
         for object in objects_to_toggle:
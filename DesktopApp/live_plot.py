@@ -0,0 +1,140 @@
+import array
+import collections
+import math
+import tkinter
+import tkinter.ttk as ttk
+
+FRAME_INTERVAL_MS = 50
+DEFAULT_SPAN_SECONDS = 30
+DEFAULT_RING_CAPACITY = 1 << 16
+PLOT_MARGIN = 4
+
+class SampleRing:
+    """Fixed capacity ring of (timestamp, value), oldest samples are overwritten"""
+
+    def __init__(self, capacity = DEFAULT_RING_CAPACITY):
+        self.capacity = capacity
+        self.timestamps = array.array('d', [0.0] * capacity)
+        self.values = array.array('d', [0.0] * capacity)
+        self.clear()
+
+    def clear(self):
+        self.head = 0
+        self.count = 0
+
+    def append(self, timestamp, value):
+        self.timestamps[self.head] = timestamp
+        self.values[self.head] = value
+        self.head = (self.head + 1) % self.capacity
+        self.count = min(self.count + 1, self.capacity)
+
+    def __len__(self):
+        return self.count
+
+    def __iter__(self):
+        start = (self.head - self.count) % self.capacity
+        for i in range(self.count):
+            index = (start + i) % self.capacity
+            yield (self.timestamps[index], self.values[index])
+
+class LodBuckets:
+    """Min/max of samples per fixed time bucket, one bucket per screen column"""
+
+    def __init__(self, bucket_seconds, max_buckets):
+        self.bucket_seconds = bucket_seconds
+        self.buckets = collections.deque(maxlen = max_buckets)
+
+    def add(self, timestamp, value):
+        bucket_id = math.floor(timestamp / self.bucket_seconds)
+        if len(self.buckets) != 0 and self.buckets[-1][0] == bucket_id:
+            (_, min_value, max_value) = self.buckets[-1]
+            self.buckets[-1] = (bucket_id, min(min_value, value), max(max_value, value))
+            return
+        if len(self.buckets) != 0 and self.buckets[-1][0] > bucket_id:
+            # late sample, plotting it is not worth reordering the buckets
+            return
+        self.buckets.append((bucket_id, value, value))
+
+class LivePlot(ttk.Frame):
+    """Scrolling chart of the last span_seconds, redrawn at most once per frame
+    so drawing cost depends on the canvas width and not on the sample rate"""
+
+    def __init__(self, parent, span_seconds = DEFAULT_SPAN_SECONDS, ring_capacity = DEFAULT_RING_CAPACITY):
+        super().__init__(parent)
+        self.span_seconds = span_seconds
+        self.ring = SampleRing(ring_capacity)
+        self.canvas = tkinter.Canvas(self, background = 'white', highlightthickness = 0)
+        self.canvas.pack(fill = tkinter.BOTH, expand = True)
+        self.canvas.bind('<Configure>', self.handle_resize)
+        self.columns = 1
+        self.lod = LodBuckets(span_seconds, 1)
+        self.is_dirty = False
+        self.frame_job = None
+        self.handle_resize(None)
+
+    def _rebuild_lod(self):
+        self.lod = LodBuckets(self.span_seconds / self.columns, self.columns + 1)
+        for (timestamp, value) in self.ring:
+            self.lod.add(timestamp, value)
+        self.is_dirty = True
+
+    def handle_resize(self, event):
+        columns = max(self.canvas.winfo_width() - 2 * PLOT_MARGIN, 1)
+        if columns != self.columns:
+            self.columns = columns
+            self._rebuild_lod()
+
+    def clear(self):
+        self.ring.clear()
+        self._rebuild_lod()
+
+    def add_samples(self, samples):
+        for (timestamp, value) in samples:
+            if value == None or math.isnan(value):
+                continue
+            self.ring.append(timestamp, value)
+            self.lod.add(timestamp, value)
+            self.is_dirty = True
+
+    def start(self):
+        if self.frame_job == None:
+            self.frame_job = self.after(FRAME_INTERVAL_MS, self.handle_frame)
+
+    def stop(self):
+        if self.frame_job != None:
+            self.after_cancel(self.frame_job)
+            self.frame_job = None
+
+    def handle_frame(self):
+        self.frame_job = self.after(FRAME_INTERVAL_MS, self.handle_frame)
+        if self.is_dirty:
+            self.is_dirty = False
+            self.redraw()
+
+    def redraw(self):
+        self.canvas.delete('all')
+        buckets = self.lod.buckets
+        if len(buckets) == 0:
+            return
+        width = self.canvas.winfo_width()
+        height = self.canvas.winfo_height()
+        last_bucket = buckets[-1][0]
+        first_bucket = last_bucket - self.columns + 1
+        visible = [bucket for bucket in buckets if bucket[0] >= first_bucket]
+        low = min(bucket[1] for bucket in visible)
+        high = max(bucket[2] for bucket in visible)
+        if high == low:
+            (low, high) = (low - 0.5, high + 0.5)
+        scale = (height - 2 * PLOT_MARGIN) / (high - low)
+        to_y = lambda value: height - PLOT_MARGIN - (value - low) * scale
+        coords = []
+        for (bucket_id, min_value, max_value) in visible:
+            x = PLOT_MARGIN + bucket_id - first_bucket
+            coords.extend((x, to_y(min_value), x, to_y(max_value)))
+        if len(coords) == 4:
+            coords.extend((coords[0] + 1, coords[1]))
+        self.canvas.create_line(*coords, fill = 'blue')
+        self.canvas.create_text(PLOT_MARGIN, PLOT_MARGIN, anchor = tkinter.NW, text = '{:g}'.format(high))
+        self.canvas.create_text(PLOT_MARGIN, height - PLOT_MARGIN, anchor = tkinter.SW, text = '{:g}'.format(low))
+        self.canvas.create_text(width - PLOT_MARGIN, height - PLOT_MARGIN, anchor = tkinter.SE,
+            text = '{} s'.format(self.span_seconds))
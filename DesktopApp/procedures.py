@@ -1,4 +1,8 @@
 import sensor_utils as utils
+import calib_lut
+import retry_policy
+import random
+import sample_codec
 import time
 
 OK_RESP = "OK"
@@ -10,6 +14,11 @@ NO_CONF_SELECTED_RESP = "NO_CONF_SELECTED"
 TRUE_RESP = "TRUE"
 FALSE_RESP = "FALSE"
 MEAS_ERRORS_CLEARED_RESP = "MEAS_ERRORS_CLEARED"
+BUSY_RESP = "BUSY"
+NO_CHANGE_RESP = "NO_CHANGE"
+NO_ACK_RESP = retry_policy.GATEWAY_NO_ACK_RESP
+NO_LINK_RESP = retry_policy.GATEWAY_NO_LINK_RESP
+BULK_END_RESP = "END"
 
 DATA_READ_FAILED = 0
 DATA_READ_SUCCESS = 1
@@ -22,6 +31,10 @@ GET_VAL_VOL_CHECK_FAILURE = 1
 GET_VAL_NO_CONF_SELECTED = 2
 GET_VAL_ERROR_OTHER = 3
 GET_VAL_NO_VAL = 4
+GET_VAL_NO_CHANGE = 5
+
+REPORT_MODE_ALWAYS = 0
+REPORT_MODE_ON_CHANGE = 1
 
 CMD_FAILURE = 0
 CMD_SUCCESS = 1
@@ -29,25 +42,137 @@ CMD_SUCCESS = 1
 TRUE = 1
 FALSE = 0
 
-RETR_COUNT = 12
-
-def _meas_get_val(serial):
-    stream = serial.get_stream()
-    stream.write(b'meas_get_val\r\n')
+COMMAND_RETRY_POLICY = retry_policy.RetryPolicy(max_attempts = 12, deadline = 15.0)
+PING_RETRY_POLICY = retry_policy.RetryPolicy(max_attempts = 12, deadline = 6.0)
+
+# "@<id><command>" lets the sensor recognize a retransmitted command and replay its response
+COMMAND_ID_PREFIX = b'@'
+COMMAND_IDS = [bytes([code]) for code in range(0x21, 0x7F)]
+PAYLOAD_MAX_LENGTH = 32
+
+AGGR_FRACTION_BITS = 6
+
+SCAN_MAX_CHANNELS = 4
+
+# handled by the gateway itself, it pulls the blob the sensor offers
+GATEWAY_BULK_COMMAND = b'#bulk'
+
+RANGE_AVCC = 0
+RANGE_1V1 = 1
+RANGE_1V1_GAIN = 2
+
+# knots of a calibration table, see calib_lut.py
+LUT_KNOT_COUNT = 16
+
+SENSOR_TIME_MASK = 0xFFFFFFFF
+# start bit + 8 data bits + stop bit at 9600 baud
+UART_BYTE_TIME_MS = 10 * 1000 / 9600
+
+def host_time_ms():
+    return int(time.time() * 1000)
+
+def sensor_time_to_host(sensor_time_ms):
+    """Unwraps 32 bit synchronized sensor time to host time in seconds"""
+    now = host_time_ms()
+    age = (now - sensor_time_ms) & SENSOR_TIME_MASK
+    if age > SENSOR_TIME_MASK // 2:
+        age -= SENSOR_TIME_MASK + 1
+    return (now - age) / 1000
+
+def _last_response(serial):
+    return serial.get_last_line().decode('UTF-8', errors = 'replace').strip()
+
+def _node_of(serial):
+    return getattr(serial.get_stream(), 'port', None)
+
+_next_command_ids = {}
+
+def _allocate_command_id(serial):
+    node = _node_of(serial)
+    if node not in _next_command_ids:
+        # clear_command_ids on connect forgets the ids of earlier sessions
+        _next_command_ids[node] = random.randrange(len(COMMAND_IDS))
+    index = _next_command_ids[node]
+    _next_command_ids[node] = (index + 1) % len(COMMAND_IDS)
+    return COMMAND_IDS[index]
+
+def _write_command(serial, payload):
+    """Tags the command with the id of the running retry, or a fresh one"""
+    command_id = serial.get_command_id()
+    if command_id == None:
+        command_id = _allocate_command_id(serial)
+    if len(COMMAND_ID_PREFIX + command_id + payload) <= PAYLOAD_MAX_LENGTH:
+        payload = COMMAND_ID_PREFIX + command_id + payload
+    serial.get_stream().write(payload + b'\r\n')
+
+def _retry(serial, policy, attempt_fun, is_success, failure_result):
+    """Every attempt sends the same command id, so a repeated command is answered from the sensor cache"""
+    classify = lambda: retry_policy.classify_response(_last_response(serial))
+    serial.set_command_id(_allocate_command_id(serial))
+    try:
+        return policy.run(attempt_fun, is_success, failure_result, classify, _node_of(serial))
+    finally:
+        serial.set_command_id(None)
+
+def _parse_sample(textline):
+    fields = textline.split(';')
+    value = float(fields[0])
+    timestamp = sensor_time_to_host(int(fields[1])) if len(fields) > 1 else time.time()
+    return (value, timestamp)
+
+def _parse_ranged_sample(textline):
+    fields = textline.split(';')
+    (value, timestamp) = _parse_sample(textline)
+    return (value, timestamp, int(fields[2]) if len(fields) > 2 else RANGE_AVCC)
+
+def _parse_scan_frame(textline):
+    fields = textline.split(';')
+    timestamp = sensor_time_to_host(int(fields[0], 16))
+    return ([int(field, 16) for field in fields[1:]], timestamp)
+
+def _meas_get_frame(serial, parse_fun):
+    _write_command(serial, b'meas_get_val')
     textline = serial.readline().decode('UTF-8').strip()
-    if textline.isspace() or len(textline) == 0:
+    if textline.isspace() or len(textline) == 0 or NA_RESP == textline:
     	return (None, GET_VAL_NO_VAL)
-    if ERR_RESP in textline:
+    if ERR_RESP in textline or NO_LINK_RESP in textline:
         return (None, GET_VAL_ERROR_OTHER)
+    if NO_ACK_RESP in textline:
+        # single lost frame, the measurement goes on
+        return (None, GET_VAL_NO_VAL)
+    if NO_CHANGE_RESP in textline:
+        return (None, GET_VAL_NO_CHANGE)
     if VOL_CHECK_FAILED_RESP in textline:
         return (None, GET_VAL_VOL_CHECK_FAILURE)
     if NO_CONF_SELECTED_RESP in textline:
         return (None, GET_VAL_NO_CONF_SELECTED)
-    return (float(textline.strip()), GET_VAL_SUCCESS)
+    try:
+        return (parse_fun(textline), GET_VAL_SUCCESS)
+    except ValueError as _:
+        return (None, GET_VAL_NO_VAL)
+
+def _meas_get_sample(serial):
+    return _meas_get_frame(serial, _parse_sample)
+
+def _meas_get_val(serial):
+    (sample, status) = _meas_get_sample(serial)
+    return (sample[0] if sample != None else None, status)
+
+def _meas_get_aggr(serial, command, convert_fun):
+    _write_command(serial, command)
+    textline = serial.readline().decode('UTF-8').strip()
+    if textline.isspace() or len(textline) == 0 or NA_RESP == textline:
+        return (None, GET_VAL_NO_VAL)
+    if ERR_RESP in textline:
+        return (None, GET_VAL_ERROR_OTHER)
+    try:
+        return (convert_fun(textline), GET_VAL_SUCCESS)
+    except ValueError as _:
+        # response of a preceding meas_get_val can still be in the pipe
+        return (None, GET_VAL_NO_VAL)
 
 def _meas_stop(serial):
-    stream = serial.get_stream()
-    stream.write(b'meas_stop\r\n')
+    _write_command(serial, b'meas_stop')
     textline = serial.readline().decode('UTF-8').strip()
     if OK_RESP in textline:
         return CMD_SUCCESS if OK_RESP in _nop_read(serial) else CMD_FAILURE
@@ -57,31 +182,77 @@ def _meas_stop(serial):
     return CMD_FAILURE
 
 def _meas_start(serial):
-    stream = serial.get_stream()
-    stream.write(b'meas_start\r\n')
+    _write_command(serial, b'meas_start')
     textline = serial.readline().decode('UTF-8').strip()
-    if ERR_RESP in textline:
+    if ERR_RESP in textline or NO_ACK_RESP in textline or NO_LINK_RESP in textline:
         return CMD_FAILURE
     return CMD_SUCCESS
 
+def _bulk_read(serial):
+    """Blob of a bulk transfer the gateway streams as hex lines, None if it broke off"""
+    serial.get_stream().write(GATEWAY_BULK_COMMAND + b'\r\n')
+    blob = bytearray()
+    while True:
+        textline = serial.readline().decode('UTF-8').strip()
+        if textline == BULK_END_RESP:
+            return bytes(blob)
+        if len(textline) == 0:
+            # read timeout, the gateway skips empty segments
+            return None
+        try:
+            blob += bytes.fromhex(textline)
+        except ValueError as _:
+            return None
+
+def _conf_dump(serial):
+    # untagged, a retry has to start a new transfer instead of getting the cached OK
+    serial.get_stream().write(b'conf_dump\r\n')
+    textline = serial.readline().decode('UTF-8').strip()
+    if len(textline) == 0 or NO_ACK_RESP in textline or NO_LINK_RESP in textline:
+        return (None, DATA_READ_FAILED)
+    blob = _bulk_read(serial)
+    if blob == None:
+        return (None, DATA_READ_FAILED)
+    return (blob, DATA_READ_SUCCESS)
+
+def _parse_backlog(blob):
+    (dropped, entries) = sample_codec.decode_backlog(blob)
+    return (dropped, [(value, sensor_time_to_host(time_ms), adc_range) for (time_ms, value, adc_range) in entries])
+
+def _meas_drain(serial):
+    # untagged like conf_dump, entries stay on the sensor until a transfer completes
+    serial.get_stream().write(b'meas_drain\r\n')
+    textline = serial.readline().decode('UTF-8').strip()
+    if len(textline) == 0 or NO_ACK_RESP in textline or NO_LINK_RESP in textline:
+        return (None, DATA_READ_FAILED)
+    blob = _bulk_read(serial)
+    if blob == None:
+        return (None, DATA_READ_FAILED)
+    try:
+        return (_parse_backlog(blob), DATA_READ_SUCCESS)
+    except ValueError as _:
+        return (None, DATA_READ_CANNOT_CONVERT)
+
 def _nop_read(serial):
     stream = serial.get_stream()
     stream.write(b'nop\r\n')
     textline = serial.readline().decode('UTF-8').strip()
     return textline
 
+def _clear_command_ids(serial):
+    # untagged, a tagged reset could itself be answered from the cache
+    serial.get_stream().write(b'cmd_clear_ids\r\n')
+    textline = serial.readline().decode('UTF-8').strip()
+    if len(textline) == 0 or NO_ACK_RESP in textline or NO_LINK_RESP in textline:
+        return CMD_FAILURE
+    return CMD_SUCCESS
+
 def _nop_ping(serial):
-    end_time = time.time() + 6
-    for _ in range(RETR_COUNT):
-        if OK_RESP in _nop_read(serial):
-            return CMD_SUCCESS
-        if time.time() > end_time:
-            break
-    return CMD_FAILURE
+    attempt = lambda: CMD_SUCCESS if OK_RESP in _nop_read(serial) else CMD_FAILURE
+    return _retry(serial, PING_RETRY_POLICY, attempt, lambda result: result == CMD_SUCCESS, CMD_FAILURE)
     
 def _get_indexed_param(serial, command, index, convert_fun):
-    stream = serial.get_stream()
-    stream.write(command + str(index).encode('UTF-8') + b'\r\n')
+    _write_command(serial, command + str(index).encode('UTF-8'))
     textline = serial.readline().decode('UTF-8').strip()
     if not OK_RESP in textline:
         return (None, DATA_READ_FAILED)
@@ -92,16 +263,12 @@ def _get_indexed_param(serial, command, index, convert_fun):
         return (None, DATA_READ_CANNOT_CONVERT)
 
 def _get_indexed_param_guarded(serial, command, index, convert_fun):
-    result = None
-    for _ in range(RETR_COUNT):
-        result = _get_indexed_param(serial, command, index, convert_fun)
-        if result[1] == DATA_READ_SUCCESS:
-            return result
-    return result
+    attempt = lambda: _get_indexed_param(serial, command, index, convert_fun)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result[1] == DATA_READ_SUCCESS,
+        (None, DATA_READ_FAILED))
     
 def _set_indexed_param(serial, command, index, encoded_value):
-    stream = serial.get_stream()
-    stream.write(command + str(index).encode('UTF-8') + b':' + encoded_value + b'\r\n')
+    _write_command(serial, command + str(index).encode('UTF-8') + b':' + encoded_value)
     textline = serial.readline().decode('UTF-8').strip()
     if not OK_RESP in textline:
         return CMD_FAILURE
@@ -111,15 +278,11 @@ def _set_indexed_param(serial, command, index, encoded_value):
     return CMD_SUCCESS
 
 def _set_indexed_param_guarded(serial, command, index, encoded_value):
-    for _ in range(RETR_COUNT):
-        result = _set_indexed_param(serial, command, index, encoded_value)
-        if result == CMD_SUCCESS:
-            return CMD_SUCCESS
-    return CMD_FAILURE
+    attempt = lambda: _set_indexed_param(serial, command, index, encoded_value)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result == CMD_SUCCESS, CMD_FAILURE)
 
 def _get_param(serial, command, convert_fun):
-    stream = serial.get_stream()
-    stream.write(command + b'\r\n')
+    _write_command(serial, command)
     textline = serial.readline().decode('UTF-8').strip()
     if not OK_RESP in textline:
         return (None, DATA_READ_FAILED)
@@ -132,16 +295,12 @@ def _get_param(serial, command, convert_fun):
         return (None, DATA_READ_CANNOT_CONVERT)
 
 def _get_param_guarded(serial, command, convert_fun):
-    result = None
-    for _ in range(RETR_COUNT):
-        result = _get_param(serial, command, convert_fun)
-        if result[1] == DATA_READ_SUCCESS:
-            return result
-    return result
+    attempt = lambda: _get_param(serial, command, convert_fun)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result[1] == DATA_READ_SUCCESS,
+        (None, DATA_READ_FAILED))
 
 def _set_param(serial, command, encoded_value):
-    stream = serial.get_stream()
-    stream.write(command + encoded_value + b'\r\n')
+    _write_command(serial, command + encoded_value)
     textline = serial.readline().decode('UTF-8').strip()
     if not OK_RESP in textline:
         return CMD_FAILURE
@@ -153,15 +312,11 @@ def _set_param(serial, command, encoded_value):
     return CMD_FAILURE
 
 def _set_param_guarded(serial, command, encoded_value):
-    for _ in range(RETR_COUNT):
-        result = _set_param(serial, command, encoded_value)
-        if result == CMD_SUCCESS:
-            return CMD_SUCCESS
-    return CMD_FAILURE
+    attempt = lambda: _set_param(serial, command, encoded_value)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result == CMD_SUCCESS, CMD_FAILURE)
 
 def _execute_single_command_with_resp(serial, command):
-    stream = serial.get_stream()
-    stream.write(command + b'\r\n')
+    _write_command(serial, command)
     textline = serial.readline().decode('UTF-8').strip()
     if not OK_RESP in textline:
         return CMD_FAILURE
@@ -173,11 +328,8 @@ def _execute_single_command_with_resp(serial, command):
     return CMD_FAILURE
 
 def _execute_single_command_with_resp_guarded(serial, command):
-    for _ in range(RETR_COUNT):
-        result = _execute_single_command_with_resp(serial, command)
-        if CMD_SUCCESS == result:
-            return CMD_SUCCESS
-    return CMD_FAILURE
+    attempt = lambda: _execute_single_command_with_resp(serial, command)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result == CMD_SUCCESS, CMD_FAILURE)
 
 def _commit_param(serial, command):
     return _execute_single_command_with_resp_guarded(serial, command)
@@ -200,6 +352,10 @@ def int_ref_is_calibrated(serial):
     convert = lambda result: True if result == TRUE_RESP else False
     return _get_param_guarded(serial, b'int_ref_is_calibrated', convert)
 
+def commit_is_pending(serial):
+    convert = lambda result: True if result == TRUE_RESP else False
+    return _get_param_guarded(serial, b'commit_is_pending', convert)
+
 def conf_get_zero_error_value(serial, index):
     convertFun = lambda x: None if "NONE" in x else int(x)
     return _get_indexed_param_guarded(serial, b'conf_get_zero_error:', index, convertFun)
@@ -228,14 +384,182 @@ def conf_set_wavelength_value(serial, index, value):
     strVal = str(value).encode('UTF-8') if value != None else "NONE".encode('UTF-8')
     return _set_indexed_param_guarded(serial, b'conf_set_wavelength:', index, strVal)
 
+def conf_set_report_mode(serial, index, mode):
+    return _set_indexed_param_guarded(serial, b'conf_set_report_mode:', index, str(mode).encode('UTF-8'))
+
+def conf_set_band(serial, index, deadband_abs, deadband_rel, hysteresis):
+    """hysteresis has to be 0 or below deadband_abs, the sensor answers OUT_OF_RANGE otherwise"""
+    encoded = ':'.join(str(value) for value in (deadband_abs, deadband_rel, hysteresis)).encode('UTF-8')
+    return _set_indexed_param_guarded(serial, b'conf_set_band:', index, encoded)
+
+def conf_set_heartbeat(serial, index, seconds):
+    return _set_indexed_param_guarded(serial, b'conf_set_heartbeat:', index, str(seconds).encode('UTF-8'))
+
+def conf_get_report(serial, index):
+    """Returns (mode, deadband_abs, deadband_rel, hysteresis, heartbeat_sec)"""
+    convertFun = lambda x: tuple(int(value) for value in x.split(';'))
+    return _get_indexed_param_guarded(serial, b'conf_get_report:', index, convertFun)
+
+def conf_set_range_zero_error_value(serial, index, adc_range, value):
+    strVal = str(value).encode('UTF-8') if value != None else "NONE".encode('UTF-8')
+    return _set_indexed_param_guarded(serial, b'conf_set_range_zero:', '{}:{}'.format(index, adc_range), strVal)
+
+def conf_set_range_gain_error_value(serial, index, adc_range, value):
+    strVal = str(value).encode('UTF-8') if value != None else "NONE".encode('UTF-8')
+    return _set_indexed_param_guarded(serial, b'conf_set_range_gain:', '{}:{}'.format(index, adc_range), strVal)
+
+def conf_get_range_calib(serial, index, adc_range):
+    """Returns (zero_error, gain_error) of RANGE_1V1 or RANGE_1V1_GAIN, None until both are set"""
+    convertFun = lambda x: None if "NONE" in x else (int(x.split(';')[0]), float(x.split(';')[1]))
+    return _get_indexed_param_guarded(serial, b'conf_get_range_calib:', '{}:{}'.format(index, adc_range), convertFun)
+
+def conf_commit_range(serial, index):
+    return _set_param_guarded(serial, b'conf_commit_range:', str(index).encode('UTF-8'))
+
+def conf_set_lut(serial, index, lut):
+    """lut is (shift, [LUT_KNOT_COUNT knots]) as calib_lut.fit returns it, None disables the table"""
+    if lut == None:
+        return _set_indexed_param_guarded(serial, b'conf_set_lut_shift:', index, "NONE".encode('UTF-8'))
+    (shift, knots) = lut
+    for (knot, value) in enumerate(knots):
+        result = _set_indexed_param_guarded(serial, b'conf_set_lut:', '{}:{}'.format(index, knot), str(value).encode('UTF-8'))
+        if result != CMD_SUCCESS:
+            return result
+    return _set_indexed_param_guarded(serial, b'conf_set_lut_shift:', index, str(shift).encode('UTF-8'))
+
+def conf_get_lut(serial, index):
+    """Returns (shift, [LUT_KNOT_COUNT knots]), shift is None while the table is disabled
+    and the knots are the ones staged for it then"""
+    convertFun = lambda x: tuple(None if value == "NONE" else int(value) for value in x.split(';'))
+    knots = []
+    for knot in range(LUT_KNOT_COUNT):
+        (result, state) = _get_indexed_param_guarded(serial, b'conf_get_lut:', '{}:{}'.format(index, knot), convertFun)
+        if state != DATA_READ_SUCCESS:
+            return (None, state)
+        (shift, value) = result
+        knots.append(value)
+    return ((shift, knots), DATA_READ_SUCCESS)
+
+def conf_commit_lut(serial, index):
+    return _set_param_guarded(serial, b'conf_commit_lut:', str(index).encode('UTF-8'))
+
+def conf_dump(serial):
+    """Returns the raw EepromData image of the sensor"""
+    attempt = lambda: _conf_dump(serial)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result[1] == DATA_READ_SUCCESS,
+        (None, DATA_READ_FAILED))
+
 def conf_select(serial, index):
     return _set_param_guarded(serial, b'conf_select:', str(index).encode('UTF-8'))
 
 def conf_commit(serial, index):
     return _set_param_guarded(serial, b'conf_commit:', str(index).encode('UTF-8'))
 
+def meas_set_oversampling(serial, extra_bits):
+    return _set_param_guarded(serial, b'meas_set_oversampling:', str(extra_bits).encode('UTF-8'))
+
+def meas_set_adc_sleep(serial, is_enabled):
+    return _set_param_guarded(serial, b'meas_set_adc_sleep:', b'1' if is_enabled else b'0')
+
+def meas_set_aggr(serial, window_size, iir_alpha):
+    args = str(window_size).encode('UTF-8') + b':' + str(iir_alpha).encode('UTF-8')
+    return _set_param_guarded(serial, b'meas_set_aggr:', args)
+
+def meas_set_scan(serial, bindings):
+    """bindings are up to SCAN_MAX_CHANNELS (adc channel, calibration slot) pairs,
+    an empty list goes back to the single channel mode"""
+    encoded = ':'.join('{}:{}'.format(channel, slot) for (channel, slot) in bindings).encode('UTF-8')
+    return _set_param_guarded(serial, b'meas_set_scan:', encoded)
+
+def meas_set_range(serial, adc_range, is_auto):
+    """Fixed adc_range, or with is_auto the most sensitive range auto ranging may use"""
+    args = str(adc_range).encode('UTF-8') + b':' + (b'1' if is_auto else b'0')
+    return _set_param_guarded(serial, b'meas_set_range:', args)
+
+def meas_set_backlog(serial, period_sec):
+    """While measuring the sensor keeps a sample every period_sec in which it got no command,
+    poll more often than that while the link is up; 0 disables, the sensor stays awake otherwise"""
+    return _set_param_guarded(serial, b'meas_set_backlog:', str(period_sec).encode('UTF-8'))
+
+def meas_drain(serial):
+    """Returns ((dropped, [(raw value, host timestamp in seconds, range)]), status), dropped
+    samples were lost to an overflow just before the first entry; calibrate with calibrate_backlog"""
+    attempt = lambda: _meas_drain(serial)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result[1] == DATA_READ_SUCCESS,
+        (None, DATA_READ_FAILED))
+
+def meas_get_aggr(serial):
+    """Returns (min, max, mean, variance) in raw adc units of the selected oversampling"""
+    def convert(text):
+        (min_val, max_val, mean, variance) = text.split(';')
+        mean = int(mean) / (1 << AGGR_FRACTION_BITS)
+        return (int(min_val), int(max_val), mean, int(variance))
+    return _meas_get_aggr(serial, b'meas_get_aggr', convert)
+
+def meas_get_iir(serial):
+    convert = lambda text: int(text) / (1 << AGGR_FRACTION_BITS)
+    return _meas_get_aggr(serial, b'meas_get_iir', convert)
+
+def calibrate_raw_value(raw_value, gain_error, zero_error, oversampling_bits = 0, lut = None):
+    """lut is the table of the slot as conf_get_lut returns it, give it only for RANGE_AVCC readings
+    like the sensor applies it"""
+    if lut != None:
+        return calib_lut.calibrate_raw_value(raw_value, gain_error, zero_error, lut, oversampling_bits)
+    return gain_error * (raw_value / (1 << oversampling_bits) + zero_error)
+
+def calibrate_aggr(aggr, gain_error, zero_error, oversampling_bits = 0, lut = None):
+    (min_val, max_val, mean, variance) = aggr
+    calibrate = lambda value: calibrate_raw_value(value, gain_error, zero_error, oversampling_bits, lut)
+    (min_val, max_val) = sorted((calibrate(min_val), calibrate(max_val)))
+    slope = 1 if lut == None else calib_lut.get_slope(lut, mean / (1 << oversampling_bits))
+    variance = variance * (gain_error * slope / (1 << oversampling_bits)) ** 2
+    return (min_val, max_val, calibrate(mean), variance)
+
+def calibrate_scan(frame, calibrations, oversampling_bits = 0):
+    """meas_get_scan frame with its values calibrated, calibrations holds (gain_error, zero_error, lut)
+    of the slot bound to each scanned channel; scans run in RANGE_AVCC"""
+    (values, timestamp) = frame
+    calibrated = [calibrate_raw_value(value, gain_error, zero_error, oversampling_bits, lut)
+        for (value, (gain_error, zero_error, lut)) in zip(values, calibrations)]
+    return (calibrated, timestamp)
+
+def calibrate_backlog(backlog, range_calibrations, oversampling_bits = 0, lut = None):
+    """meas_drain result with its values calibrated, range_calibrations maps each range to its
+    (gain_error, zero_error) and lut is the table of the slot, used for RANGE_AVCC entries"""
+    (dropped, entries) = backlog
+    calibrated = []
+    for (value, timestamp, adc_range) in entries:
+        (gain_error, zero_error) = range_calibrations[adc_range]
+        entry_lut = lut if adc_range == RANGE_AVCC else None
+        calibrated.append((calibrate_raw_value(value, gain_error, zero_error, oversampling_bits, entry_lut),
+            timestamp, adc_range))
+    return (dropped, calibrated)
+
+def _time_sync(serial):
+    command = b'time_sync:'
+    now_ms = host_time_ms()
+    # the sensor reads its clock only after the whole tagged command went through the uart
+    length = len(COMMAND_ID_PREFIX) + 1 + len(command) + len(str(now_ms & SENSOR_TIME_MASK)) + 2
+    transfer_ms = int(length * UART_BYTE_TIME_MS)
+    encoded_time = str(((now_ms + transfer_ms) & SENSOR_TIME_MASK)).encode('UTF-8')
+    return _set_param(serial, command, encoded_time)
+
+def time_sync(serial):
+    # every attempt takes the host time anew, a retry must not send the time of a previous one
+    attempt = lambda: _time_sync(serial)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result == CMD_SUCCESS, CMD_FAILURE)
+
+def time_get(serial):
+    return _get_param_guarded(serial, b'time_get', lambda x: sensor_time_to_host(int(x)))
+
 def nop(serial):
     return _nop_ping(serial)
+
+def clear_command_ids(serial):
+    """Makes the sensor forget the command ids of earlier sessions, send it first on connect.
+    Only delivery is checked, the sensor answers like nop and not at all while measuring"""
+    attempt = lambda: _clear_command_ids(serial)
+    return _retry(serial, COMMAND_RETRY_POLICY, attempt, lambda result: result == CMD_SUCCESS, CMD_FAILURE)
     
 def meas_start(serial):
     return _meas_start(serial)
@@ -245,4 +569,17 @@ def meas_stop(serial):
 
 def meas_get_val(serial):
     return _meas_get_val(serial)
+
+def meas_get_sample(serial):
+    """Returns ((value, host timestamp in seconds), status)"""
+    return _meas_get_sample(serial)
+
+def meas_get_ranged_sample(serial):
+    """Returns ((value, host timestamp in seconds, range), status)"""
+    return _meas_get_frame(serial, _parse_ranged_sample)
+
+def meas_get_scan(serial):
+    """Returns (([raw value per scanned channel], host timestamp in seconds), status),
+    calibrate with calibrate_scan and the slots bound to the channels"""
+    return _meas_get_frame(serial, _parse_scan_frame)
  
@@ -0,0 +1,418 @@
+import argparse
+import array
+import bisect
+import json
+import math
+import mmap
+import struct
+import sys
+import zlib
+
+# File layout:
+#   file header : MAGIC, version, json header length, json header (calibration snapshot)
+#   blocks      : block header, zlib(timestamp deltas | values | statuses)
+#   index       : INDEX_MAGIC, entry count, entries (offset + block statistics)
+#   trailer     : index offset, TRAILER_MAGIC
+# All numbers are little endian, timestamps are milliseconds since epoch.
+# Block statistics hold sum and count of valid values, so means of whole blocks
+# are known without decompressing them. Timestamps never decrease within a block,
+# a clock sync that moves them back starts a new block, so blocks are not sorted.
+
+MAGIC = b'LSREC\x00'
+VERSION = 1
+BLOCK_MAGIC = b'BLK\x00'
+INDEX_MAGIC = b'IDX\x00'
+TRAILER_MAGIC = b'LSIX'
+
+FILE_HEADER = struct.Struct('<6sHI')
+INDEX_HEADER = struct.Struct('<4sI')
+TRAILER = struct.Struct('<Q4s')
+# magic, sample count, compressed size, first timestamp, last timestamp, min value, max value,
+# valid count, sum of valid values
+BLOCK_HEADER = struct.Struct('<4sIIqqddId')
+# block offset, sample count, first timestamp, last timestamp, min value, max value,
+# valid count, sum of valid values
+INDEX_ENTRY = struct.Struct('<QIqqddId')
+
+DEFAULT_BLOCK_SIZE = 4096
+
+STATUS_OK = 0
+STATUS_VOL_CHECK_FAILURE = 1
+STATUS_ERROR = 2
+
+STATUS_NAMES = {
+    STATUS_OK: 'OK',
+    STATUS_VOL_CHECK_FAILURE: 'VOL_CHECK_FAILURE',
+    STATUS_ERROR: 'ERROR',
+}
+
+class RecordingFormatException(Exception):
+    pass
+
+class BlockInfo:
+    def __init__(self, offset, count, first, last, min_value, max_value, valid_count, value_sum):
+        self.offset = offset
+        self.count = count
+        self.first = first
+        self.last = last
+        self.min_value = min_value
+        self.max_value = max_value
+        self.valid_count = valid_count
+        self.value_sum = value_sum
+
+class BucketStats:
+    def __init__(self, start):
+        self.start = start
+        self.count = 0
+        self.min_value = math.inf
+        self.max_value = -math.inf
+        self.value_sum = 0.0
+
+    def add_value(self, value):
+        if math.isnan(value):
+            return
+        self.count += 1
+        self.value_sum += value
+        self.min_value = min(self.min_value, value)
+        self.max_value = max(self.max_value, value)
+
+    def add_block(self, block):
+        if block.valid_count == 0:
+            return
+        self.count += block.valid_count
+        self.value_sum += block.value_sum
+        self.min_value = min(self.min_value, block.min_value)
+        self.max_value = max(self.max_value, block.max_value)
+
+    def add_bucket(self, other):
+        self.count += other.count
+        self.value_sum += other.value_sum
+        self.min_value = min(self.min_value, other.min_value)
+        self.max_value = max(self.max_value, other.max_value)
+
+    def mean(self):
+        return self.value_sum / self.count if self.count != 0 else math.nan
+
+def _to_little_endian(column):
+    if sys.byteorder != 'little':
+        column.byteswap()
+    return column
+
+def _values_stats(values):
+    finite = [value for value in values if not math.isnan(value)]
+    if len(finite) == 0:
+        return (math.nan, math.nan, 0, 0.0)
+    return (min(finite), max(finite), len(finite), math.fsum(finite))
+
+def encode_block(offset, timestamps, values, statuses):
+    deltas = array.array('q', [0] * len(timestamps))
+    for i in range(1, len(timestamps)):
+        deltas[i] = timestamps[i] - timestamps[i-1]
+    payload = b''.join([
+        _to_little_endian(deltas).tobytes(),
+        _to_little_endian(array.array('d', values)).tobytes(),
+        array.array('B', statuses).tobytes()])
+    compressed = zlib.compress(payload)
+    (min_value, max_value, valid_count, value_sum) = _values_stats(values)
+    header = BLOCK_HEADER.pack(BLOCK_MAGIC, len(timestamps), len(compressed),
+        timestamps[0], timestamps[-1], min_value, max_value, valid_count, value_sum)
+    info = BlockInfo(offset, len(timestamps), timestamps[0], timestamps[-1], min_value, max_value, valid_count, value_sum)
+    return (header + compressed, info)
+
+def decode_block_payload(compressed, count, first_timestamp):
+    payload = zlib.decompress(compressed)
+    deltas = array.array('q')
+    deltas.frombytes(payload[:8*count])
+    values = array.array('d')
+    values.frombytes(payload[8*count:16*count])
+    if sys.byteorder != 'little':
+        deltas.byteswap()
+        values.byteswap()
+    statuses = array.array('B')
+    statuses.frombytes(payload[16*count:17*count])
+    timestamps = array.array('q', [0] * count)
+    timestamp = first_timestamp
+    for i in range(count):
+        timestamp += deltas[i]
+        timestamps[i] = timestamp
+    return (timestamps, values, statuses)
+
+class RecordingWriter:
+    """Streams samples into a binary recording, one compressed block per block_size samples"""
+
+    def __init__(self, file, header, block_size = DEFAULT_BLOCK_SIZE):
+        self.file = file
+        self.block_size = block_size
+        self.index = []
+        self._clear_pending()
+        encoded_header = json.dumps(header).encode('UTF-8')
+        self.file.write(FILE_HEADER.pack(MAGIC, VERSION, len(encoded_header)))
+        self.file.write(encoded_header)
+
+    def _clear_pending(self):
+        self.timestamps = []
+        self.values = []
+        self.statuses = []
+
+    def append(self, timestamp, value, status = STATUS_OK):
+        timestamp_ms = int(round(timestamp * 1000))
+        if len(self.timestamps) != 0 and timestamp_ms < self.timestamps[-1]:
+            # the clock went back, blocks keep their timestamps in order
+            self.flush()
+        self.timestamps.append(timestamp_ms)
+        self.values.append(float(value) if value != None else math.nan)
+        self.statuses.append(status)
+        if len(self.timestamps) >= self.block_size:
+            self.flush()
+
+    def flush(self):
+        if len(self.timestamps) == 0:
+            return
+        (encoded, info) = encode_block(self.file.tell(), self.timestamps, self.values, self.statuses)
+        self.file.write(encoded)
+        self.file.flush()
+        self.index.append(info)
+        self._clear_pending()
+
+    def close(self):
+        self.flush()
+        index_offset = self.file.tell()
+        self.file.write(INDEX_HEADER.pack(INDEX_MAGIC, len(self.index)))
+        for info in self.index:
+            self.file.write(INDEX_ENTRY.pack(info.offset, info.count, info.first, info.last,
+                info.min_value, info.max_value, info.valid_count, info.value_sum))
+        self.file.write(TRAILER.pack(index_offset, TRAILER_MAGIC))
+        self.file.close()
+
+class RecordingReader:
+    """Memory maps a recording, only blocks touched by a query are decompressed.
+    The index is rebuilt from block headers if the writer was not closed."""
+
+    def __init__(self, filename):
+        self.file = open(filename, 'rb')
+        try:
+            self.data = mmap.mmap(self.file.fileno(), 0, access = mmap.ACCESS_READ)
+        except ValueError:
+            self.file.close()
+            raise RecordingFormatException("File is empty")
+        try:
+            self.header = self._read_header()
+            self.index = self._read_index()
+        except (struct.error, ValueError) as e:
+            self.close()
+            raise RecordingFormatException("Corrupted recording: " + str(e))
+
+    def _read_header(self):
+        if len(self.data) < FILE_HEADER.size:
+            raise RecordingFormatException("File is too short")
+        (magic, version, header_length) = FILE_HEADER.unpack_from(self.data, 0)
+        if magic != MAGIC or version != VERSION:
+            raise RecordingFormatException("Not a recording file or unsupported version")
+        self.data_offset = FILE_HEADER.size + header_length
+        return json.loads(self.data[FILE_HEADER.size:self.data_offset].decode('UTF-8'))
+
+    def _read_index(self):
+        file_size = len(self.data)
+        if file_size < self.data_offset + TRAILER.size:
+            return self._scan_blocks()
+        (index_offset, magic) = TRAILER.unpack_from(self.data, file_size - TRAILER.size)
+        if magic != TRAILER_MAGIC or index_offset + INDEX_HEADER.size > file_size:
+            return self._scan_blocks()
+        (index_magic, count) = INDEX_HEADER.unpack_from(self.data, index_offset)
+        if index_magic != INDEX_MAGIC:
+            return self._scan_blocks()
+        offset = index_offset + INDEX_HEADER.size
+        return [BlockInfo(*INDEX_ENTRY.unpack_from(self.data, offset + i * INDEX_ENTRY.size)) for i in range(count)]
+
+    def _scan_blocks(self):
+        index = []
+        offset = self.data_offset
+        while offset + BLOCK_HEADER.size <= len(self.data):
+            fields = BLOCK_HEADER.unpack_from(self.data, offset)
+            (magic, count, compressed_size) = fields[:3]
+            if magic != BLOCK_MAGIC or offset + BLOCK_HEADER.size + compressed_size > len(self.data):
+                break
+            index.append(BlockInfo(offset, count, *fields[3:]))
+            offset += BLOCK_HEADER.size + compressed_size
+        return index
+
+    def read_block(self, block_number):
+        block = self.index[block_number]
+        compressed_size = BLOCK_HEADER.unpack_from(self.data, block.offset)[2]
+        payload_offset = block.offset + BLOCK_HEADER.size
+        return decode_block_payload(self.data[payload_offset:payload_offset + compressed_size], block.count, block.first)
+
+    def time_range(self):
+        if len(self.index) == 0:
+            return None
+        return (min(block.first for block in self.index), max(block.last for block in self.index))
+
+    def blocks_in_range(self, start_ms, end_ms):
+        """Numbers of blocks that may hold samples with start_ms <= timestamp < end_ms, in file order;
+        a clock sync may leave blocks out of time order, so every index entry is checked"""
+        for block_number in range(len(self.index)):
+            block = self.index[block_number]
+            if block.first < end_ms and block.last >= start_ms:
+                yield block_number
+
+    def samples(self, start_ms = -math.inf, end_ms = math.inf):
+        """Samples in recording order, timestamps only increase within a block"""
+        for block_number in self.blocks_in_range(start_ms, end_ms):
+            (timestamps, values, statuses) = self.read_block(block_number)
+            first = bisect.bisect_left(timestamps, start_ms) if start_ms != -math.inf else 0
+            for i in range(first, len(timestamps)):
+                if timestamps[i] >= end_ms:
+                    break
+                yield (timestamps[i], values[i], statuses[i])
+
+    def bucket_stats(self, start_ms, end_ms, bucket_ms):
+        """Returns BucketStats for every bucket_ms wide bucket in [start_ms, end_ms), blocks lying
+        entirely inside one bucket are summarized from the index without decompression"""
+        buckets = {}
+        def bucket_for(timestamp):
+            bucket_start = start_ms + ((timestamp - start_ms) // bucket_ms) * bucket_ms
+            if bucket_start not in buckets:
+                buckets[bucket_start] = BucketStats(bucket_start)
+            return buckets[bucket_start]
+        for block_number in self.blocks_in_range(start_ms, end_ms):
+            block = self.index[block_number]
+            is_inside_range = block.first >= start_ms and block.last < end_ms
+            is_inside_bucket = (block.first - start_ms) // bucket_ms == (block.last - start_ms) // bucket_ms
+            if is_inside_range and is_inside_bucket:
+                bucket_for(block.first).add_block(block)
+                continue
+            (timestamps, values, _) = self.read_block(block_number)
+            for i in range(len(timestamps)):
+                if start_ms <= timestamps[i] < end_ms:
+                    bucket_for(timestamps[i]).add_value(values[i])
+        return [buckets[key] for key in sorted(buckets)]
+
+    def close(self):
+        self.data.close()
+        self.file.close()
+
+def export_to_csv(recording_filename, csv_filename, start_ms = -math.inf, end_ms = math.inf):
+    reader = RecordingReader(recording_filename)
+    try:
+        with open(csv_filename, 'w') as csv_file:
+            for (key, value) in sorted(reader.header.items()):
+                csv_file.write('# {}={}\n'.format(key, value))
+            csv_file.write('timestamp;value;status\n')
+            for (timestamp, value, status) in reader.samples(start_ms, end_ms):
+                value_text = '' if math.isnan(value) else repr(value)
+                csv_file.write('{:.3f};{};{}\n'.format(timestamp / 1000, value_text, STATUS_NAMES.get(status, status)))
+    finally:
+        reader.close()
+
+def _seconds_to_ms(value):
+    return int(round(float(value) * 1000))
+
+def _print_info(reader):
+    for (key, value) in sorted(reader.header.items()):
+        print('{}: {}'.format(key, value))
+    time_range = reader.time_range()
+    samples_count = sum(block.count for block in reader.index)
+    print('blocks: {}, samples: {}'.format(len(reader.index), samples_count))
+    if time_range != None:
+        print('time range: {:.3f} - {:.3f}'.format(time_range[0] / 1000, time_range[1] / 1000))
+
+def _print_stats(reader, start_ms, end_ms, bucket_ms):
+    time_range = reader.time_range()
+    if time_range == None:
+        return
+    start_ms = time_range[0] if start_ms == None else start_ms
+    end_ms = time_range[1] + 1 if end_ms == None else end_ms
+    bucket_ms = (end_ms - start_ms) if bucket_ms == None else bucket_ms
+    print('bucket_start;count;min;max;mean')
+    for bucket in reader.bucket_stats(start_ms, end_ms, max(bucket_ms, 1)):
+        if bucket.count == 0:
+            print('{:.3f};0;;;'.format(bucket.start / 1000))
+            continue
+        print('{:.3f};{};{};{};{}'.format(bucket.start / 1000, bucket.count, bucket.min_value,
+            bucket.max_value, bucket.mean()))
+
+def main(argv):
+    parser = argparse.ArgumentParser(description = 'LightSensor recording tool')
+    subparsers = parser.add_subparsers(dest = 'command', required = True)
+    info_parser = subparsers.add_parser('info', help = 'show header and time range')
+    info_parser.add_argument('recording')
+    stats_parser = subparsers.add_parser('stats', help = 'min/max/mean per time bucket')
+    stats_parser.add_argument('recording')
+    export_parser = subparsers.add_parser('export', help = 'convert to csv')
+    export_parser.add_argument('recording')
+    export_parser.add_argument('csv')
+    for range_parser in (stats_parser, export_parser):
+        range_parser.add_argument('--start', type = _seconds_to_ms, help = 'unix time in seconds')
+        range_parser.add_argument('--end', type = _seconds_to_ms, help = 'unix time in seconds')
+    stats_parser.add_argument('--bucket', type = _seconds_to_ms, help = 'bucket width in seconds')
+    args = parser.parse_args(argv)
+
+    if args.command == 'export':
+        start_ms = -math.inf if args.start == None else args.start
+        end_ms = math.inf if args.end == None else args.end
+        export_to_csv(args.recording, args.csv, start_ms, end_ms)
+        return
+    reader = RecordingReader(args.recording)
+    try:
+        if args.command == 'info':
+            _print_info(reader)
+        else:
+            _print_stats(reader, args.start, args.end, args.bucket)
+    finally:
+        reader.close()
+
+if __name__ == "__main__":
+    import os
+    import tempfile
+
+    # blocks of 4 samples, the clock goes back by 7 s after the third sample
+    TEST_SAMPLES = [(10.0, 1.0), (11.0, 2.0), (12.0, None), (5.0, 4.0), (6.0, 5.0), (7.0, 6.0),
+        (8.0, 7.0), (9.0, 8.0), (13.0, 9.0)]
+
+    def write_test_recording(filename, is_closed):
+        writer = RecordingWriter(open(filename, 'wb'), {'gain_error': 1.0}, block_size = 4)
+        for (timestamp, value) in TEST_SAMPLES:
+            writer.append(timestamp, value, STATUS_OK if value != None else STATUS_ERROR)
+        writer.flush()
+        if is_closed:
+            writer.close()
+        else:
+            writer.file.close()
+
+    def verify_round_trip(is_closed):
+        (handle, filename) = tempfile.mkstemp(suffix = '.lsrec')
+        os.close(handle)
+        try:
+            write_test_recording(filename, is_closed)
+            reader = RecordingReader(filename)
+            try:
+                assert reader.header == {'gain_error': 1.0}
+                assert [(block.first, block.last, block.count) for block in reader.index] == \
+                    [(10000, 12000, 3), (5000, 8000, 4), (9000, 13000, 2)]
+                assert reader.time_range() == (5000, 13000)
+                samples = list(reader.samples())
+                assert [timestamp for (timestamp, _, _) in samples] == [int(t * 1000) for (t, _) in TEST_SAMPLES]
+                assert math.isnan(samples[2][1]) and samples[2][2] == STATUS_ERROR
+                # blocks keep recording order, each one is cut to the range
+                assert [timestamp for (timestamp, _, _) in reader.samples(6000, 11000)] == \
+                    [10000, 6000, 7000, 8000, 9000]
+                # the second block lies inside one bucket and is summarized from the index
+                buckets = reader.bucket_stats(5000, 15000, 5000)
+                assert [(bucket.start, bucket.count, bucket.min_value, bucket.max_value, bucket.mean())
+                    for bucket in buckets] == [(5000, 5, 4.0, 8.0, 6.0), (10000, 3, 1.0, 9.0, 4.0)]
+                # every block spans buckets here and is decompressed, the invalid sample leaves its bucket empty
+                buckets = reader.bucket_stats(5500, 14500, 1000)
+                assert [(bucket.start, bucket.count) for bucket in buckets] == \
+                    [(5500, 1), (6500, 1), (7500, 1), (8500, 1), (9500, 1), (10500, 1), (11500, 0), (12500, 1)]
+            finally:
+                reader.close()
+        finally:
+            os.remove(filename)
+        print("test passed")
+
+    if sys.argv[1:] == ['--self-test']:
+        verify_round_trip(True)
+        # the index is rebuilt from the block headers
+        verify_round_trip(False)
+    else:
+        main(sys.argv[1:])
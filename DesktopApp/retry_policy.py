@@ -0,0 +1,116 @@
+"""Retry policy shared by the procedures: exponential backoff with full jitter,
+a total deadline, per error class handling and a circuit breaker per node"""
+import random
+import time
+
+# gateway got no ACK from the sensor or the uart read timed out
+ERROR_CLASS_RADIO = 'radio'
+# sensor is alive but cannot take the command yet
+ERROR_CLASS_BUSY = 'busy'
+# sensor answered ERROR or something unexpected, the pipeline may be out of step
+ERROR_CLASS_PROTOCOL = 'protocol'
+# sensor gave a definite answer, repeating the command gives the same one
+ERROR_CLASS_PERMANENT = 'permanent'
+
+GATEWAY_NO_ACK_RESP = "NO_ACK"
+GATEWAY_NO_LINK_RESP = "NO_LINK"
+
+_PERMANENT_RESPONSES = ("OUT_OF_RANGE", "NO_CONF_SELECTED", "CHECK_FAILED", "NA")
+
+def classify_response(textline):
+    if textline == None:
+        return ERROR_CLASS_PROTOCOL
+    if len(textline) == 0 or textline.isspace() or GATEWAY_NO_ACK_RESP in textline or GATEWAY_NO_LINK_RESP in textline:
+        return ERROR_CLASS_RADIO
+    if "BUSY" in textline:
+        return ERROR_CLASS_BUSY
+    for response in _PERMANENT_RESPONSES:
+        if textline == response:
+            return ERROR_CLASS_PERMANENT
+    return ERROR_CLASS_PROTOCOL
+
+class CircuitBreaker:
+    """Opens after failure_threshold operations in a row lost the radio link,
+    then lets a single probe through every reset_timeout seconds"""
+    CLOSED = 'closed'
+    OPEN = 'open'
+    HALF_OPEN = 'half_open'
+
+    def __init__(self, failure_threshold = 3, reset_timeout = 10.0):
+        self.failure_threshold = failure_threshold
+        self.reset_timeout = reset_timeout
+        self.state = CircuitBreaker.CLOSED
+        self.failures = 0
+        self.opened_at = 0.0
+
+    def allow_request(self):
+        if self.state == CircuitBreaker.OPEN and time.monotonic() - self.opened_at >= self.reset_timeout:
+            self.state = CircuitBreaker.HALF_OPEN
+        return self.state != CircuitBreaker.OPEN
+
+    def is_probing(self):
+        return self.state == CircuitBreaker.HALF_OPEN
+
+    def record_success(self):
+        self.state = CircuitBreaker.CLOSED
+        self.failures = 0
+
+    def record_failure(self):
+        self.failures += 1
+        if self.state == CircuitBreaker.HALF_OPEN or self.failures >= self.failure_threshold:
+            self.state = CircuitBreaker.OPEN
+            self.opened_at = time.monotonic()
+
+_breakers = {}
+
+def get_breaker(node):
+    if node not in _breakers:
+        _breakers[node] = CircuitBreaker()
+    return _breakers[node]
+
+class RetryPolicy:
+
+    def __init__(self, max_attempts = 12, base_delay = 0.05, max_delay = 2.0, deadline = 15.0,
+            max_protocol_errors = 3):
+        self.max_attempts = max_attempts
+        self.base_delay = base_delay
+        self.max_delay = max_delay
+        self.deadline = deadline
+        self.max_protocol_errors = max_protocol_errors
+
+    def backoff(self, attempt):
+        return random.uniform(0, min(self.max_delay, self.base_delay * (2 ** attempt)))
+
+    def run(self, attempt_fun, is_success, failure_result, classify_fun, node = None):
+        """Calls attempt_fun until is_success(result), classify_fun tells why the last attempt failed.
+        Returns failure_result without any traffic while the node's breaker is open"""
+        breaker = get_breaker(node) if node != None else None
+        if breaker != None and not breaker.allow_request():
+            return failure_result
+        max_attempts = 1 if breaker != None and breaker.is_probing() else self.max_attempts
+        end_time = time.monotonic() + self.deadline
+        protocol_errors = 0
+        error_class = None
+        result = failure_result
+        for attempt in range(max_attempts):
+            result = attempt_fun()
+            if is_success(result):
+                error_class = None
+                break
+            error_class = classify_fun()
+            if error_class == ERROR_CLASS_PERMANENT:
+                break
+            if error_class == ERROR_CLASS_PROTOCOL:
+                protocol_errors += 1
+                if protocol_errors >= self.max_protocol_errors:
+                    break
+            delay = self.backoff(attempt)
+            if time.monotonic() + delay >= end_time:
+                break
+            time.sleep(delay)
+        if breaker != None:
+            if error_class == ERROR_CLASS_RADIO:
+                breaker.record_failure()
+            else:
+                breaker.record_success()
+        return result
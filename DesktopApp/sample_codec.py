@@ -0,0 +1,194 @@
+"""Decoder of the sensor's sample coding: zig-zag mapped deltas written as varints,
+7 bits per byte with low bits first and the top bit set on all but the last byte.
+
+Decoding and calibration work on whole columns held in arrays. They run in the _sample_codec
+extension when it is built (python setup.py build_ext --inplace) and in Python otherwise."""
+import array
+import calib_lut
+import struct
+
+try:
+    import _sample_codec
+except ImportError:
+    _sample_codec = None
+
+TIME_MASK = 0xFFFFFFFF
+RAW_VALUE_MAX = 0xFFFF
+# codes are at most 32 bits
+VARINT_MAX_SHIFT = 28
+
+# dropped count, entry count
+BACKLOG_HEADER = struct.Struct('<HB')
+# time in ms, raw value, range
+BACKLOG_FIRST_ENTRY = struct.Struct('<IHB')
+
+def unzigzag(code):
+    return (code >> 1) ^ -(code & 1)
+
+def read_varint(data, offset):
+    """Returns (value, offset past it), ValueError on truncated data or codes over 32 bits"""
+    value = 0
+    shift = 0
+    while True:
+        if offset >= len(data):
+            raise ValueError("truncated varint")
+        byte = data[offset]
+        offset += 1
+        value |= (byte & 0x7F) << shift
+        if value > TIME_MASK:
+            break
+        if byte < 0x80:
+            return (value, offset)
+        shift += 7
+        if shift > VARINT_MAX_SHIFT:
+            break
+    raise ValueError("varint over 32 bits")
+
+def _decode_backlog_columns(blob):
+    if len(blob) < BACKLOG_HEADER.size:
+        raise ValueError("truncated header")
+    (dropped, count) = BACKLOG_HEADER.unpack_from(blob)
+    times = array.array('I')
+    values = array.array('H')
+    ranges = array.array('B')
+    if count == 0:
+        return (dropped, times, values, ranges)
+    if len(blob) < BACKLOG_HEADER.size + BACKLOG_FIRST_ENTRY.size:
+        raise ValueError("truncated header")
+    (time_ms, value, adc_range) = BACKLOG_FIRST_ENTRY.unpack_from(blob, BACKLOG_HEADER.size)
+    offset = BACKLOG_HEADER.size + BACKLOG_FIRST_ENTRY.size
+    times.append(time_ms)
+    values.append(value)
+    ranges.append(adc_range)
+    step = 0
+    for _ in range(count - 1):
+        (code, offset) = read_varint(blob, offset)
+        # the sensor works mod 2^32, a clock sync may move time either way
+        step = (step + unzigzag(code)) & TIME_MASK
+        time_ms = (time_ms + step) & TIME_MASK
+        (code, offset) = read_varint(blob, offset)
+        value += unzigzag(code >> 1)
+        if value < 0 or value > RAW_VALUE_MAX:
+            raise ValueError("raw value out of range")
+        if code & 1:
+            if offset >= len(blob):
+                raise ValueError("truncated range")
+            adc_range = blob[offset]
+            offset += 1
+        times.append(time_ms)
+        values.append(value)
+        ranges.append(adc_range)
+    return (dropped, times, values, ranges)
+
+def _array_from_bytes(typecode, data):
+    result = array.array(typecode)
+    result.frombytes(data)
+    return result
+
+def decode_backlog_columns(blob):
+    """Returns (dropped, times in ms, raw values, ranges) of a backlog drain image,
+    the columns are arrays of types 'I', 'H' and 'B'; ValueError on bad data"""
+    if _sample_codec == None:
+        return _decode_backlog_columns(blob)
+    (dropped, times, values, ranges) = _sample_codec.decode_backlog_columns(blob)
+    return (dropped, _array_from_bytes('I', times), _array_from_bytes('H', values), _array_from_bytes('B', ranges))
+
+def decode_backlog(blob):
+    """Returns (dropped, [(time_ms, raw value, range)]) of a backlog drain image"""
+    (dropped, times, values, ranges) = decode_backlog_columns(blob)
+    return (dropped, list(zip(times, values, ranges)))
+
+def calibrate_values(values, gain_error, zero_error, oversampling_bits = 0, lut = None):
+    """Array of type 'd' with procedures.calibrate_raw_value applied to each raw value,
+    lut only for readings of RANGE_AVCC"""
+    if not (isinstance(values, array.array) and values.typecode == 'H'):
+        values = array.array('H', values)
+    if lut != None:
+        return array.array('d', (calib_lut.calibrate_raw_value(value, gain_error, zero_error, lut, oversampling_bits)
+            for value in values))
+    if _sample_codec != None:
+        return _array_from_bytes('d', _sample_codec.calibrate(values, gain_error, zero_error, oversampling_bits))
+    scale = 1 << oversampling_bits
+    return array.array('d', (gain_error * (value / scale + zero_error) for value in values))
+
+if __name__ == "__main__":
+    def zigzag(value):
+        return ((value << 1) ^ (value >> 31)) & TIME_MASK
+
+    def write_varint(value):
+        result = bytearray()
+        while value >= 0x80:
+            result.append((value & 0x7F) | 0x80)
+            value >>= 7
+        result.append(value)
+        return bytes(result)
+
+    def encode_backlog(dropped, entries):
+        """Copy of the sensor's backlog drain image (backlog.c)"""
+        blob = bytearray(BACKLOG_HEADER.pack(dropped, len(entries)))
+        if len(entries) == 0:
+            return bytes(blob)
+        (time_ms, value, adc_range) = entries[0]
+        blob += BACKLOG_FIRST_ENTRY.pack(time_ms, value, adc_range)
+        previous_step = 0
+        for (next_time_ms, next_value, next_range) in entries[1:]:
+            step = (next_time_ms - time_ms) & TIME_MASK
+            step_change = (step - previous_step) & TIME_MASK
+            if step_change > TIME_MASK >> 1:
+                step_change -= TIME_MASK + 1
+            blob += write_varint(zigzag(step_change))
+            blob += write_varint((zigzag(next_value - value) << 1) | (next_range != adc_range))
+            if next_range != adc_range:
+                blob.append(next_range)
+            previous_step = step
+            (time_ms, value, adc_range) = (next_time_ms, next_value, next_range)
+        return bytes(blob)
+
+    BACKLOGS = [
+        (0, []),
+        (3, [(1000, 512, 0)]),
+        # steady period, a clock sync back by 5 s, a range change and a full scale swing
+        (0, [(1000, 512, 0), (2000, 515, 0), (3000, 510, 0), (-2000 & TIME_MASK, 510, 0),
+            (-1000 & TIME_MASK, 0, 2), (0, RAW_VALUE_MAX, 2), (1000, 0, 1)]),
+        # the sensor clock wraps around 2^32 ms
+        (65535, [(TIME_MASK - 1500, 700, 1), (TIME_MASK - 500, 701, 1), (499, 702, 1), (1499, 702, 0)]),
+    ]
+
+    def verify_decode_backlog():
+        for (dropped, entries) in BACKLOGS:
+            assert decode_backlog(encode_backlog(dropped, entries)) == (dropped, entries)
+        print("test passed")
+
+    def decode_or_error(blob):
+        try:
+            return decode_backlog(blob)
+        except ValueError as e:
+            return str(e)
+
+    def verify_native_matches_python():
+        global _sample_codec
+        native = _sample_codec
+        if native == None:
+            print("test skipped, _sample_codec is not built")
+            return
+        blobs = [encode_backlog(dropped, entries) for (dropped, entries) in BACKLOGS]
+        # every truncation, a varint running over 32 bits and a value leaving the raw scale
+        blobs += [blob[:length] for blob in blobs for length in range(len(blob))]
+        blobs.append(BACKLOG_HEADER.pack(0, 2) + BACKLOG_FIRST_ENTRY.pack(0, 0, 0) + b'\xff\xff\xff\xff\x7f\x00')
+        blobs.append(BACKLOG_HEADER.pack(0, 2) + BACKLOG_FIRST_ENTRY.pack(0, 0, 0) + b'\x00\x02')
+        for blob in blobs:
+            native_result = decode_or_error(blob)
+            _sample_codec = None
+            python_result = decode_or_error(blob)
+            _sample_codec = native
+            assert native_result == python_result
+        values = array.array('H', range(0, RAW_VALUE_MAX, 7))
+        native_values = calibrate_values(values, 1.0123, -3.5, 2)
+        _sample_codec = None
+        python_values = calibrate_values(values, 1.0123, -3.5, 2)
+        _sample_codec = native
+        assert native_values == python_values
+        print("test passed")
+
+    verify_decode_backlog()
+    verify_native_matches_python()
@@ -1,12 +1,18 @@
 import serial
 import time
 
+class SerialPortException(Exception):
+    pass
+
 class StreamWrapper:
 
     def __init__(self, stream, buffer_size):
         self.stream = stream
         self.buffer_limit = buffer_size
-        self.buffer = b''
+        # grows in place while a line comes in pieces
+        self.buffer = bytearray()
+        self.last_line = b''
+        self.command_id = None
 
     def _readline_impl(self):
         read_data = b''
@@ -23,8 +29,8 @@ class StreamWrapper:
         except ValueError as _:
             self.buffer += read_data
             return b''
-        result = self.buffer + read_data[:index_nl+1]
-        self.buffer = read_data[index_nl+1:]
+        result = bytes(self.buffer + read_data[:index_nl+1])
+        self.buffer = bytearray(read_data[index_nl+1:])
         return result
 
     def readline(self):
@@ -32,11 +38,91 @@ class StreamWrapper:
         result = self._readline_impl()
         if len(self.buffer) > self.buffer_limit:
             raise ValueError("buffer limit reached")
+        self.last_line = result
         return result
         
     def get_stream(self):
         return self.stream
 
+    def get_last_line(self):
+        return self.last_line
+
+    def get_command_id(self):
+        return self.command_id
+
+    def set_command_id(self, command_id):
+        self.command_id = command_id
+
+def open_serial(device):
+    serial_port = serial.Serial()
+    try:
+        serial_port.port = device
+        serial_port.baudrate=9600
+        timeout = 4
+        # FTDI avoid cached values on uart
+        serial_port.timeout = 0.8
+        serial_port.open()
+        serial_port.read(4000)
+        serial_port.timeout = timeout
+
+        serial_wrapper = StreamWrapper(serial_port, 100)
+        return (serial_port, serial_wrapper)
+    except:
+        serial_port.close()
+        raise SerialPortException("Cannot connect with serial device: " + str(device))
+
+class SampleQueue:
+    """Bounded single producer, single consumer queue of samples.
+
+    The producer never blocks: when the consumer falls behind, new samples
+    are dropped and counted. Only the producer moves write_index and only
+    the consumer moves read_index, so no lock is needed under the GIL."""
+
+    def __init__(self, capacity):
+        self.capacity = capacity
+        self.slots = [None] * capacity
+        self.write_index = 0
+        self.read_index = 0
+        self.pushed = 0
+        self.dropped = 0
+        self.high_water = 0
+        self.batches = 0
+        self.max_batch = 0
+
+    def __len__(self):
+        return self.write_index - self.read_index
+
+    def push(self, sample):
+        used = self.write_index - self.read_index
+        if used >= self.capacity:
+            self.dropped += 1
+            return False
+        self.slots[self.write_index % self.capacity] = sample
+        self.write_index += 1
+        self.pushed += 1
+        self.high_water = max(self.high_water, used + 1)
+        return True
+
+    def take_batch(self, limit = None):
+        end = self.write_index
+        if limit != None:
+            end = min(end, self.read_index + limit)
+        batch = []
+        for index in range(self.read_index, end):
+            slot = index % self.capacity
+            batch.append(self.slots[slot])
+            self.slots[slot] = None
+        self.read_index = end
+        if len(batch) != 0:
+            self.batches += 1
+            self.max_batch = max(self.max_batch, len(batch))
+        return batch
+
+    def get_stats(self):
+        return {'pushed': self.pushed, 'dropped': self.dropped, 'pending': len(self),
+            'high_water': self.high_water, 'capacity': self.capacity,
+            'batches': self.batches, 'max_batch': self.max_batch}
+
 if __name__ == "__main__":
     class MockStream:
         def __init__(self):
@@ -81,7 +167,21 @@ if __name__ == "__main__":
         assert stream_reader.readline() == b'2222\n'
         print("test passed")
 
+    def verify_sample_queue():
+        queue = SampleQueue(4)
+        for i in range(6):
+            queue.push(i)
+        assert queue.get_stats()['dropped'] == 2
+        assert queue.take_batch(3) == [0, 1, 2]
+        assert queue.push(6)
+        assert queue.take_batch() == [3, 6]
+        assert queue.take_batch() == []
+        stats = queue.get_stats()
+        assert stats['pushed'] == 5 and stats['high_water'] == 4 and stats['max_batch'] == 3
+        print("test passed")
+
     verify_readline()
+    verify_sample_queue()
 
 
 
@@ -0,0 +1,7 @@
+"""Builds the optional _sample_codec extension next to the sources:
+    python setup.py build_ext --inplace
+sample_codec falls back to Python without it"""
+from setuptools import setup, Extension
+
+setup(name = 'light-sensor-desktop',
+    ext_modules = [Extension('_sample_codec', ['_sample_codec.c'])])